@@ -0,0 +1,29 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stdbool.h>
+
+#define BLOOM_HASHES 7
+#define BLOOM_BITS_PER_NAME 10
+#define BLOOM_MIN_BYTES 1024
+// in-place writers only write back the pages of the filter that changed
+#define BLOOM_PAGE 4096
+
+// a Bloom filter over record names: no false negatives, so a name it does not
+// hold is certainly not in the table; deletes leave their bits set
+struct bloom_t {
+    unsigned char* bits;
+    unsigned int nbytes;
+    bool* dirty;
+};
+
+unsigned int bloom_size(unsigned int names);
+int bloom_create(unsigned int nbytes, struct bloom_t** bloomOut);
+int bloom_load(const void* bytes, unsigned int nbytes, struct bloom_t** bloomOut);
+void bloom_add(struct bloom_t* bloom, const char* name, unsigned int len);
+bool bloom_may_contain(const struct bloom_t* bloom, const char* name, unsigned int len);
+unsigned int bloom_pages(const struct bloom_t* bloom);
+void bloom_clean(struct bloom_t* bloom);
+void bloom_free(struct bloom_t* bloom);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+
+// Castagnoli CRC, continues from a previous crc (pass 0 to start)
+unsigned int crc32c(unsigned int crc, const void* buf, size_t len);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef CURSOR_H
+#define CURSOR_H
+
+#include <stdbool.h>
+#include "file.h"
+#include "parse.h"
+
+// a batch is one read: CURSOR_BATCH_RECORDS records, or one block of a
+// compressed file; CURSOR_DEPTH batches are buffered, the one being decoded
+// and the rest in flight behind it
+#define CURSOR_BATCH_RECORDS 256
+#define CURSOR_DEPTH 4
+
+// streams the live records of a file in constant memory, whatever its size;
+// a compressed file only adds its block index. The caller keeps the file from
+// changing under it, by holding the data read lock or handing it a pinned copy
+struct db_cursor_t {
+    int fd;
+    bool direct;
+    struct db_header_t* header;
+    struct db_block_t* index;
+    // names of the current batch, dropped when the next one starts
+    struct strpool_t* names;
+    int nbatches;
+    int batch;
+    int submitted;
+    int pos;
+    int batch_records;
+    unsigned char* slots[CURSOR_DEPTH];
+    struct db_io_t ios[CURSOR_DEPTH];
+    // where each batch starts in its slot and how long it is
+    size_t skews[CURSOR_DEPTH];
+    size_t lengths[CURSOR_DEPTH];
+    struct employee_rec_t* records;
+    // a compressed batch is decompressed here
+    struct employee_rec_t* block;
+    struct employee_t current;
+};
+
+int db_cursor_open(int fd, struct db_header_t* header, struct db_cursor_t** cursorOut);
+int db_cursor_next(struct db_cursor_t* cursor, const struct employee_t** employeeOut);
+void db_cursor_close(struct db_cursor_t* cursor);
+
+#endif
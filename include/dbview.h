@@ -0,0 +1,58 @@
+#ifndef DBVIEW_H
+#define DBVIEW_H
+
+#include <stdbool.h>
+
+// the embeddable face of dbview: a handle holds the table in memory, changes
+// go out on dbview_sync or dbview_close as one commit, the way one CLI run does;
+// every call returns DBVIEW_OK or one of the negative codes below, and nothing
+// is printed, dbview_errmsg says what went wrong
+struct dbview_t;
+
+#define DBVIEW_OK 0
+// I/O failed, the file is corrupt or memory ran out
+#define DBVIEW_ERROR -1
+// no live record has that name
+#define DBVIEW_NOTFOUND -2
+// a NULL argument, bad flags or a write through a read-only handle
+#define DBVIEW_MISUSE -3
+
+// only this API is exported from libdbview.so, the rest stays internal
+#if defined(__GNUC__)
+#define DBVIEW_API __attribute__((visibility("default")))
+#else
+#define DBVIEW_API
+#endif
+
+// a writable handle holds the writer lock until it is closed, a read-only one
+// works on the image that was committed when it was opened
+#define DBVIEW_READONLY 0x1
+// start a new, empty database at path, replacing whatever was there
+#define DBVIEW_CREATE 0x2
+
+// pointers stay valid until the next call that changes the handle
+struct dbview_record_t {
+    const char* name;
+    const char* address;
+    unsigned int hours;
+};
+
+// a non-zero return stops the iteration and is what dbview_iterate returns
+typedef int (*dbview_visit_t)(const struct dbview_record_t* record, void* ctx);
+
+DBVIEW_API int dbview_open(const char* path, int flags, struct dbview_t** dbOut);
+// the live records, or a negative code
+DBVIEW_API int dbview_count(struct dbview_t* db);
+DBVIEW_API int dbview_get(struct dbview_t* db, const char* name, struct dbview_record_t* out);
+DBVIEW_API int dbview_add(struct dbview_t* db, const char* name, const char* address, unsigned int hours);
+DBVIEW_API int dbview_update(struct dbview_t* db, const char* name, const char* address, unsigned int hours);
+DBVIEW_API int dbview_delete(struct dbview_t* db, const char* name);
+DBVIEW_API int dbview_iterate(struct dbview_t* db, dbview_visit_t visit, void* ctx);
+DBVIEW_API int dbview_sync(struct dbview_t* db);
+// a handle that could not reload the file after a commit fails every call
+// with DBVIEW_ERROR and only closes
+DBVIEW_API int dbview_close(struct dbview_t* db);
+// why the last call on this thread failed, "" after one that succeeded
+DBVIEW_API const char* dbview_errmsg(void);
+
+#endif
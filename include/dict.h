@@ -0,0 +1,24 @@
+#ifndef DICT_H
+#define DICT_H
+
+// a deduplicated string table, strings are referred to by their id, the order
+// they were first interned in; bytes holds them NUL-terminated as on disk
+struct dict_t {
+    char* bytes;
+    unsigned int used;
+    unsigned int size;
+    unsigned int count;
+    unsigned int* offsets;
+    // open addressing over ids, 0 is an empty slot, otherwise id + 1
+    unsigned int* slots;
+    unsigned int nslots;
+};
+
+int dict_create(struct dict_t** dictOut);
+int dict_load(const char* bytes, unsigned int used, unsigned int count, struct dict_t** dictOut);
+int dict_intern(struct dict_t* dict, const char* s, unsigned int* idOut);
+int dict_lookup(const struct dict_t* dict, const char* s, unsigned int* idOut);
+const char* dict_string(const struct dict_t* dict, unsigned int id);
+void dict_free(struct dict_t* dict);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef ERROR_H
+#define ERROR_H
+
+#include <stdbool.h>
+
+// the shared code reports failures through these instead of printf/perror: a
+// CLI run prints them as it always has, the library keeps the first one of a
+// call for dbview_errmsg and leaves the host program's output alone. Capturing
+// is switched per thread
+#define ERROR_MESSAGE_MAX 256
+
+void report_error(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+void report_errno(const char* what);
+void error_capture(bool enable);
+void error_clear(void);
+const char* error_last(void);
+
+#endif
@@ -1,7 +1,52 @@
 #ifndef FILE_H
 #define FILE_H
 
+#include <stdbool.h>
+#include <sys/types.h>
+
+// SHARED readers hold off writers for as long as the file is open, EXCLUSIVE
+// is taken by writers and serializes them, SNAPSHOT reads whichever committed
+// image was current at open time and only holds the data read lock
+#define DB_LOCK_SHARED 0
+#define DB_LOCK_EXCLUSIVE 1
+#define DB_LOCK_SNAPSHOT 2
+
+// one positioned read or write; io_uring when set up, pread/pwrite otherwise
+struct db_io_t {
+    void* buf;
+    size_t len;
+    off_t offset;
+    ssize_t result;
+    bool write;
+    bool done;
+    bool allow_short;
+};
+
+// --direct reads bypass the page cache in chunks of DB_DIRECT_CHUNK, aligned
+// to DB_DIRECT_ALIGN, with DB_DIRECT_DEPTH of them in flight
+#define DB_DIRECT_ALIGN 4096
+#define DB_DIRECT_CHUNK (1 << 20)
+#define DB_DIRECT_DEPTH 4
+
 int create_db_file(const char* path);
-int open_db_file(char* path);
+int open_db_file(char* path, int lock_mode);
+int open_db_file_readonly(char* path, int lock_mode);
+int lock_db_data(int fd, bool exclusive);
+int unlock_db_data(int fd);
+int write_full(int fd, const void* buf, size_t len);
+int create_temp_db_file(const char* path, char* tmppathOut, size_t size);
+int commit_temp_db_file(int tmpfd, const char* tmppath, const char* path);
+int export_db_range(int fd, off_t offset, size_t length, int out_fd);
+int snapshot_db_file(int fd, const char* dest);
+int pin_db_image(int fd, const char* path);
+int db_io_setup(bool use_uring);
+int db_io_submit(int fd, struct db_io_t* ios, int n, bool write);
+int db_io_wait(int fd, struct db_io_t* ios, int n);
+int db_io_batch(int fd, struct db_io_t* ios, int n, bool write);
+void db_io_set_direct(bool enable);
+bool db_io_is_direct(void);
+int set_fd_direct(int fd, bool enable);
+int read_scan(int fd, void* dst, size_t len, off_t offset);
+void drop_scan_cache(int fd, off_t offset, size_t len);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,12 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+
+// LZ4-style block codec: byte oriented LZ77 with a 64 KiB window, tuned for
+// speed over ratio; the long NUL runs in record padding collapse to a few bytes
+size_t lz_compress_bound(size_t len);
+size_t lz_compress(const void* src, size_t len, void* dst, size_t cap);
+int lz_decompress(const void* src, size_t len, void* dst, size_t cap, size_t* lenOut);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef NAMEMATCH_H
+#define NAMEMATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// size of the fixed, NUL padded name field of an on-disk record
+#define NAME_FIELD_SIZE 256
+
+// a name prepared once for matching against many name fields: zero padded to
+// the field size so the vector kernels can load whole chunks of it
+struct name_query_t {
+    char padded[NAME_FIELD_SIZE];
+    size_t len;
+};
+
+void name_query_init(struct name_query_t* query, const char* name);
+bool name_query_match(const struct name_query_t* query, const char* field);
+int name_query_scan(const struct name_query_t* query, const void* records, size_t stride, int n);
+
+#endif
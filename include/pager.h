@@ -0,0 +1,46 @@
+#ifndef PAGER_H
+#define PAGER_H
+
+#include <stdbool.h>
+#include "parse.h"
+
+// a page is a run of whole records so no record straddles two frames
+#define DB_PAGE_SIZE 16384
+#define RECORDS_PER_PAGE (DB_PAGE_SIZE / sizeof(struct employee_rec_t))
+#define DB_POOL_DEFAULT_FRAMES 64
+
+struct pager_frame_t {
+    int page;
+    bool dirty;
+    bool referenced;
+    struct employee_t* records;
+    // names of the records in this frame, dropped when the frame is reused
+    struct strpool_t* names;
+};
+
+struct pager_t {
+    int fd;
+    struct db_header_t* header;
+    struct dict_t* addresses;
+    // NULL when the run only reads, nothing is added or looked up then
+    struct bloom_t* bloom;
+    int nframes;
+    int hand;
+    struct pager_frame_t* frames;
+    bool header_dirty;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long writebacks;
+};
+
+int pager_open(int fd, struct db_header_t* header, struct dict_t* addresses, struct bloom_t* bloom, int nframes, struct pager_t** pagerOut);
+struct employee_t* pager_get(struct pager_t* pager, int index, bool for_write);
+struct employee_t* pager_append(struct pager_t* pager, const struct employee_t* e);
+int pager_flush(struct pager_t* pager);
+void pager_close(struct pager_t* pager);
+
+int pager_add_employee(struct pager_t* pager, char* addstring);
+int pager_delete_employee(struct pager_t* pager, char* name);
+void pager_list_employees(struct pager_t* pager, int format);
+
+#endif
@@ -2,27 +2,153 @@
 #ifndef PARSE_H
 #define PARSE_H
 
+#include <stdbool.h>
+#include "bloom.h"
+#include "file.h"
+#include "dict.h"
+#include "strpool.h"
+
 #define HEADER_MAGIC 0x4c4c4144
+#define DB_VERSION 0x7
+// v1 files have a 12-byte header and records with both strings inline and no
+// checksum; they are loaded into the current form and upgraded by the next write
+#define DB_VERSION_V1 0x1
+#define DB_V1_HEADER_SIZE 12
+
+// header flags; a compressed file keeps its records in LZ blocks behind an index
+#define DB_FLAG_COMPRESSED 0x1
+// in-memory only: the next write drops every tombstone, as --compact asks
+#define DB_FLAG_COMPACT 0x2000
+// in-memory only: the records are still in the v1 layout, see DB_VERSION_V1
+#define DB_FLAG_V1 0x4000
+// in-memory only: the on-disk layout changes, so the next write rewrites the file
+#define DB_FLAG_REWRITE 0x8000
+
+// records flagged as deleted keep their slot until the file is compacted
+#define EMPLOYEE_DELETED 0x1
+// in-memory only: the record differs from its on-disk copy, never written out
+#define EMPLOYEE_DIRTY 0x80000000
+
+#define LIST_FORMAT_TEXT 0
+#define LIST_FORMAT_JSON 1
+#define LIST_FORMAT_TSV 2
+#define LIST_FORMAT_BINARY 3
+
+#define COMPACT_THRESHOLD_PERCENT 25
+#define COMPACT_CHUNK_RECORDS 256
+
+// read_employees keeps READ_AHEAD_CHUNKS reads in flight ahead of decoding
+#define READ_CHUNK_RECORDS 256
+#define READ_AHEAD_CHUNKS 8
+
+// the address dictionary gets at least this much room between header and records,
+// new addresses are appended in place until it fills up
+#define DICT_MIN_RESERVE 4096
+
+// records per compressed block, the unit of random access in a compressed file
+#define COMPRESS_BLOCK_RECORDS 64
 
 struct db_header_t {
     unsigned int magic;
     unsigned short version;
     unsigned short count;
     unsigned int filesize;
+    unsigned short deleted;
+    unsigned short flags;
+    unsigned int checksum;
+    // records (or the block index) start at data_offset, the address dictionary
+    // takes dict_bytes of the room between the header and there
+    unsigned int data_offset;
+    unsigned int dict_bytes;
+    unsigned int dict_count;
+    unsigned int dict_crc;
+    // the name filter takes the last bloom_bytes before data_offset
+    unsigned int bloom_bytes;
+    unsigned int bloom_crc;
 };
 
-struct employee_t {
+// longest name a record holds, the rest of the field is NUL padding
+#define EMPLOYEE_NAME_MAX 255
+
+// a record as stored, in network byte order
+struct employee_rec_t {
+    char name[256];
+    unsigned int address_id;
+    unsigned int hours;
+    unsigned int flags;
+    unsigned int crc;
+};
+
+// a record as v1 stored it, hours in network byte order
+struct employee_v1_rec_t {
     char name[256];
     char address[256];
     unsigned int hours;
 };
 
-int delete_employee(struct db_header_t* header, struct employee_t** employees, char* name);
+// what --verify found: records that fail their checksum, name an address the
+// dictionary lacks or sit in a block that fails its own; without an intact
+// dictionary no record is checked
+struct verify_result_t {
+    int records;
+    int corrupt;
+    bool dict_ok;
+    bool bloom_ok;
+};
+
+// a record in memory, its name interned in a string pool with hash and length
+// precomputed, so name equality rarely needs to touch the bytes
+struct employee_t {
+    const char* name;
+    unsigned int name_hash;
+    unsigned int name_len;
+    unsigned int address_id;
+    unsigned int hours;
+    unsigned int flags;
+};
+
+// one entry per block at data_offset, followed by the CRC32C of the entries as
+// stored; offset is from the start of the file
+struct db_block_t {
+    unsigned int offset;
+    unsigned int length;
+    unsigned int crc;
+};
+
+void encode_db_header(struct db_header_t* header, int count, struct db_header_t* out);
+void encode_employee(const struct employee_t* e, struct employee_rec_t* out);
+int decode_employee(const struct employee_rec_t* rec, struct strpool_t* names, struct employee_t* out);
+bool employee_has_name(const struct employee_t* e, const char* name, unsigned int len, unsigned int hash);
+int build_employee(const char* name, const char* addr, unsigned int hours, struct strpool_t* names, struct dict_t* addresses, struct employee_t* out);
+int parse_employee(char* addstring, struct strpool_t* names, struct dict_t* addresses, struct employee_t* out);
+int find_employee(struct db_header_t* header, struct employee_t* employees, const char* name);
+int delete_employee(struct db_header_t* header, struct employee_t** employees, const char* name);
 int create_db_header(int fd, struct db_header_t** headerOut);
 int retrieve_and_validate_db_header(int fd, struct db_header_t** headerOut);
-int read_employees(int fd, struct db_header_t*, struct employee_t** employeesOut);
-int add_employee(struct db_header_t*, struct employee_t** employees, char* addstring);
-int output_file(int fd, struct db_header_t* header, struct employee_t* employees);
-void list_employees(struct db_header_t* header, struct employee_t* employees);
+int read_employees(int fd, struct db_header_t*, struct strpool_t* names, struct dict_t* addresses, struct employee_t** employeesOut);
+int read_address_dict(int fd, struct db_header_t* header, struct dict_t** dictOut);
+bool dict_fits(struct db_header_t* header, struct dict_t* addresses);
+void set_dict_header(struct db_header_t* header, struct dict_t* addresses);
+int read_name_bloom(int fd, struct db_header_t* header, struct bloom_t** bloomOut);
+int build_name_bloom(struct db_header_t* header, struct employee_t* employees, unsigned int nbytes, struct bloom_t** bloomOut);
+int scan_name_bloom(int fd, struct db_header_t* header, unsigned int nbytes, struct bloom_t** bloomOut);
+bool bloom_fits(struct db_header_t* header, struct bloom_t* bloom);
+void set_bloom_header(struct db_header_t* header, struct bloom_t* bloom);
+int commit_in_place(int fd, struct db_header_t* header, struct dict_t* addresses, struct bloom_t* bloom, struct db_io_t* ios, int n, bool commit_header);
+int append_employee(struct db_header_t* header, struct employee_t** employees, const struct employee_t* e);
+int add_employee(struct db_header_t*, struct employee_t** employees, struct strpool_t* names, struct dict_t* addresses, char* addstring);
+int output_file(int fd, const char* path, struct db_header_t* header, struct employee_t* employees, struct dict_t* addresses, struct bloom_t* bloom);
+void list_begin(int format);
+void list_employee(const struct employee_t* e, struct dict_t* addresses, int format, int nth);
+void list_end(int format);
+void print_db_info(struct db_header_t* header, int format);
+bool needs_compaction(struct db_header_t* header);
+int compact_db_file(int fd, const char* path, struct db_header_t* header, struct dict_t* addresses);
+int verify_db_file(int fd, struct db_header_t* header, struct verify_result_t* resultOut);
+int read_block_index(int fd, struct db_header_t* header, struct db_block_t** indexOut);
+int block_count(struct db_header_t* header);
+int block_records(struct db_header_t* header, int block);
+int decompress_block(struct db_header_t* header, const struct db_block_t* index, int block, const unsigned char* src, struct employee_rec_t* out);
+int read_compressed_block(int fd, struct db_header_t* header, const struct db_block_t* index, int block, struct employee_rec_t* out);
 
 #endif // PARSE_H
\ No newline at end of file
@@ -0,0 +1,58 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include <stdio.h>
+#include "parse.h"
+
+#define SORT_NONE -1
+#define SORT_BY_NAME 0
+#define SORT_BY_ADDRESS 1
+#define SORT_BY_HOURS 2
+
+// records a sorter holds in memory; a larger table is sorted in runs of this
+// many, spilled to a temp file and merged back with SORT_MERGE_RECORDS of each
+// run buffered
+#ifndef SORT_RUN_RECORDS
+#define SORT_RUN_RECORDS 8192
+#endif
+#define SORT_MERGE_RECORDS 64
+
+// records are fed in table order and come out sorted by one field, ties in
+// table order; hours sort with a radix sort, strings with qsort
+struct sorter_t {
+    int field;
+    struct dict_t* addresses;
+    struct employee_rec_t* run;
+    unsigned int* order;
+    unsigned int* scratch;
+    int used;
+    // runs spilled so far, all SORT_RUN_RECORDS long but the last
+    FILE* spill;
+    int nruns;
+    int spilled;
+};
+
+// the k records with the greatest key seen so far, in a min-heap on that key so
+// the root is the one to drop next; ties keep the earlier record
+struct topk_t {
+    int field;
+    struct dict_t* addresses;
+    int k;
+    int n;
+    unsigned int seen;
+    struct employee_rec_t* recs;
+    unsigned int* seqs;
+};
+
+int sort_field_parse(const char* name, int* fieldOut);
+int sorter_create(int field, struct dict_t* addresses, struct sorter_t** sorterOut);
+int sorter_add(struct sorter_t* sorter, const struct employee_t* e);
+int sorter_list(struct sorter_t* sorter, int format);
+void sorter_free(struct sorter_t* sorter);
+
+int topk_create(int field, int k, struct dict_t* addresses, struct topk_t** topkOut);
+int topk_add(struct topk_t* topk, const struct employee_t* e);
+int topk_list(struct topk_t* topk, int format);
+void topk_free(struct topk_t* topk);
+
+#endif
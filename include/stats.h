@@ -0,0 +1,53 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+enum db_phase_t {
+    PHASE_OPEN,
+    PHASE_VALIDATE,
+    PHASE_LOAD,
+    PHASE_MUTATE,
+    PHASE_LIST,
+    PHASE_WRITE,
+    PHASE_COUNT,
+};
+
+enum db_syscall_t {
+    SYSCALL_OPEN,
+    SYSCALL_READ,
+    SYSCALL_WRITE,
+    SYSCALL_SYNC,
+    SYSCALL_LOCK,
+    SYSCALL_RING_ENTER,
+    SYSCALL_OTHER,
+    SYSCALL_COUNT,
+};
+
+struct db_stats_t {
+    bool enabled;
+    double started;
+    double phase_started[PHASE_COUNT];
+    double phase_seconds[PHASE_COUNT];
+    unsigned long syscalls[SYSCALL_COUNT];
+    unsigned long long bytes_read;
+    unsigned long long bytes_written;
+    // buffer pool counters, summed over the pagers a run closed
+    unsigned long pool_hits;
+    unsigned long pool_misses;
+    unsigned long pool_writebacks;
+};
+
+// counters are always kept, they are only reported when --stats is given
+extern struct db_stats_t db_stats;
+
+void stats_enable(void);
+void stats_phase_begin(enum db_phase_t phase);
+void stats_phase_end(enum db_phase_t phase);
+void stats_bytes(bool written, ssize_t bytes);
+void stats_syscall(enum db_syscall_t kind, ssize_t bytes);
+void stats_pool(unsigned long hits, unsigned long misses, unsigned long writebacks);
+void stats_print_json(void);
+
+#endif
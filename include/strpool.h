@@ -0,0 +1,34 @@
+#ifndef STRPOOL_H
+#define STRPOOL_H
+
+#include <stddef.h>
+
+// interned strings live in arena blocks that never move, so pointers into the
+// pool stay valid until strpool_reset; equal strings share one copy
+struct strpool_block_t {
+    struct strpool_block_t* next;
+    size_t size;
+    size_t used;
+    char bytes[];
+};
+
+struct strpool_entry_t {
+    const char* s;
+    unsigned int hash;
+    unsigned int len;
+};
+
+struct strpool_t {
+    struct strpool_block_t* blocks;
+    struct strpool_entry_t* slots;
+    unsigned int nslots;
+    unsigned int count;
+};
+
+unsigned int strpool_hash(const char* s, size_t len);
+int strpool_create(struct strpool_t** poolOut);
+const char* strpool_intern(struct strpool_t* pool, const char* s, size_t len, unsigned int hash);
+void strpool_reset(struct strpool_t* pool);
+void strpool_free(struct strpool_t* pool);
+
+#endif
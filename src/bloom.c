@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bloom.h"
+#include "common.h"
+#include "crc32c.h"
+#include "error.h"
+#include "strpool.h"
+
+// a power of two so probes reduce with a mask
+unsigned int bloom_size(unsigned int names) {
+    unsigned long bytes = (unsigned long)names * BLOOM_BITS_PER_NAME / 8;
+    unsigned int nbytes = BLOOM_MIN_BYTES;
+    while (nbytes < bytes) {
+        nbytes *= 2;
+    }
+    return nbytes;
+}
+
+unsigned int bloom_pages(const struct bloom_t* bloom) {
+    return (bloom->nbytes + BLOOM_PAGE - 1) / BLOOM_PAGE;
+}
+
+int bloom_create(unsigned int nbytes, struct bloom_t** bloomOut) {
+    if (nbytes == 0 || (nbytes & (nbytes - 1)) != 0) {
+        report_error("Bad filter size: %u\n", nbytes);
+        return STATUS_ERROR;
+    }
+    struct bloom_t* bloom = calloc(1, sizeof(struct bloom_t));
+    if (bloom == NULL) {
+        report_error("Calloc failed\n");
+        return STATUS_ERROR;
+    }
+    bloom->nbytes = nbytes;
+    bloom->bits   = calloc(nbytes, 1);
+    bloom->dirty  = calloc(bloom_pages(bloom), sizeof(bool));
+    if (bloom->bits == NULL || bloom->dirty == NULL) {
+        report_error("Calloc failed\n");
+        bloom_free(bloom);
+        return STATUS_ERROR;
+    }
+    *bloomOut = bloom;
+    return STATUS_SUCCESS;
+}
+
+int bloom_load(const void* bytes, unsigned int nbytes, struct bloom_t** bloomOut) {
+    struct bloom_t* bloom = NULL;
+    if (bloom_create(nbytes, &bloom) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    memcpy(bloom->bits, bytes, nbytes);
+    *bloomOut = bloom;
+    return STATUS_SUCCESS;
+}
+
+// double hashing: probe i lands on h1 + i * h2, h2 odd so probes never repeat
+static void probes(const struct bloom_t* bloom, const char* name, unsigned int len, unsigned int* out) {
+    unsigned int h1   = strpool_hash(name, len);
+    unsigned int h2   = crc32c(0, name, len) | 1;
+    unsigned int mask = bloom->nbytes * 8 - 1;
+    for (int i = 0; i < BLOOM_HASHES; i++) {
+        out[i] = (h1 + i * h2) & mask;
+    }
+}
+
+void bloom_add(struct bloom_t* bloom, const char* name, unsigned int len) {
+    unsigned int bits[BLOOM_HASHES];
+    probes(bloom, name, len, bits);
+    for (int i = 0; i < BLOOM_HASHES; i++) {
+        unsigned char* byte = &bloom->bits[bits[i] / 8];
+        unsigned char mask  = 1 << (bits[i] % 8);
+        if (!(*byte & mask)) {
+            *byte |= mask;
+            bloom->dirty[bits[i] / 8 / BLOOM_PAGE] = true;
+        }
+    }
+}
+
+bool bloom_may_contain(const struct bloom_t* bloom, const char* name, unsigned int len) {
+    unsigned int bits[BLOOM_HASHES];
+    probes(bloom, name, len, bits);
+    for (int i = 0; i < BLOOM_HASHES; i++) {
+        if (!(bloom->bits[bits[i] / 8] & (1 << (bits[i] % 8)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void bloom_clean(struct bloom_t* bloom) {
+    memset(bloom->dirty, 0, sizeof(bool) * bloom_pages(bloom));
+}
+
+void bloom_free(struct bloom_t* bloom) {
+    if (bloom == NULL) {
+        return;
+    }
+    free(bloom->bits);
+    free(bloom->dirty);
+    free(bloom);
+}
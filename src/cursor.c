@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "cursor.h"
+#include "error.h"
+#include "lz.h"
+
+static bool is_compressed(struct db_cursor_t* cursor) {
+    return cursor->header->flags & DB_FLAG_COMPRESSED;
+}
+
+static int records_in(struct db_cursor_t* cursor, int batch) {
+    if (is_compressed(cursor)) {
+        return block_records(cursor->header, batch);
+    }
+    int n = cursor->header->count - batch * CURSOR_BATCH_RECORDS;
+    return n < CURSOR_BATCH_RECORDS ? n : CURSOR_BATCH_RECORDS;
+}
+
+// O_DIRECT reads whole aligned blocks, the batch then starts skew bytes into
+// its slot; either way the read goes out now and is waited for when the batch
+// is reached
+static int submit(struct db_cursor_t* cursor, int batch) {
+    int slot           = batch % CURSOR_DEPTH;
+    struct db_io_t* io = &cursor->ios[slot];
+    memset(io, 0, sizeof(struct db_io_t));
+    io->buf = cursor->slots[slot];
+    if (is_compressed(cursor)) {
+        io->len    = cursor->index[batch].length;
+        io->offset = cursor->index[batch].offset;
+    } else {
+        io->len    = sizeof(struct employee_rec_t) * records_in(cursor, batch);
+        io->offset = cursor->header->data_offset + sizeof(struct employee_rec_t) * batch * CURSOR_BATCH_RECORDS;
+    }
+    cursor->lengths[slot] = io->len;
+    cursor->skews[slot]   = 0;
+    if (cursor->direct) {
+        off_t first         = io->offset & ~((off_t)DB_DIRECT_ALIGN - 1);
+        cursor->skews[slot] = io->offset - first;
+        io->len             = (cursor->skews[slot] + io->len + DB_DIRECT_ALIGN - 1) & ~((size_t)DB_DIRECT_ALIGN - 1);
+        io->offset          = first;
+        // the last block may run past the end of the file
+        io->allow_short = true;
+    }
+    cursor->submitted = batch + 1;
+    return db_io_submit(cursor->fd, io, 1, false);
+}
+
+static int begin_batch(struct db_cursor_t* cursor, int batch) {
+    int slot           = batch % CURSOR_DEPTH;
+    struct db_io_t* io = &cursor->ios[slot];
+    if (db_io_wait(cursor->fd, io, 1) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    if (cursor->direct && (size_t)io->result < cursor->skews[slot] + cursor->lengths[slot]) {
+        report_error("Short read at offset %lld\n", (long long)(io->offset + io->result));
+        return STATUS_ERROR;
+    }
+    unsigned char* data = cursor->slots[slot] + cursor->skews[slot];
+    if (is_compressed(cursor)) {
+        if (decompress_block(cursor->header, cursor->index, batch, data, cursor->block) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+        cursor->records = cursor->block;
+    } else {
+        cursor->records = (struct employee_rec_t*)data;
+    }
+    strpool_reset(cursor->names);
+    cursor->batch         = batch;
+    cursor->pos           = 0;
+    cursor->batch_records = records_in(cursor, batch);
+
+    // the slot of the batch before this one is free for the next read
+    if (batch > 0 && batch - 1 + CURSOR_DEPTH < cursor->nbatches) {
+        return submit(cursor, batch - 1 + CURSOR_DEPTH);
+    }
+    return STATUS_SUCCESS;
+}
+
+int db_cursor_open(int fd, struct db_header_t* header, struct db_cursor_t** cursorOut) {
+    if (fd < 0) {
+        report_error("Got a bad FD from the user\n");
+        return STATUS_ERROR;
+    }
+    if (header->flags & DB_FLAG_V1) {
+        report_error("A version 1 file has to be upgraded before it can be streamed\n");
+        return STATUS_ERROR;
+    }
+    struct db_cursor_t* cursor = calloc(1, sizeof(struct db_cursor_t));
+    if (cursor == NULL) {
+        report_error("Calloc failed\n");
+        return STATUS_ERROR;
+    }
+    cursor->fd     = fd;
+    cursor->header = header;
+    cursor->batch  = -1;
+
+    size_t slot_size = sizeof(struct employee_rec_t) * CURSOR_BATCH_RECORDS;
+    int status       = strpool_create(&cursor->names);
+    if (status == STATUS_SUCCESS && header->flags & DB_FLAG_COMPRESSED) {
+        cursor->nbatches = block_count(header);
+        slot_size        = lz_compress_bound(sizeof(struct employee_rec_t) * COMPRESS_BLOCK_RECORDS);
+        cursor->block    = malloc(sizeof(struct employee_rec_t) * COMPRESS_BLOCK_RECORDS);
+        status           = cursor->block == NULL ? STATUS_ERROR : read_block_index(fd, header, &cursor->index);
+    } else {
+        cursor->nbatches = (header->count + CURSOR_BATCH_RECORDS - 1) / CURSOR_BATCH_RECORDS;
+    }
+    // a block that claims to be longer than any block we write is corrupt
+    for (int b = 0; status == STATUS_SUCCESS && cursor->index && b < cursor->nbatches; b++) {
+        if (cursor->index[b].length > slot_size) {
+            report_error("Corrupt compressed block %d\n", b);
+            status = STATUS_ERROR;
+        }
+    }
+
+    // O_DIRECT stays on for the cursor's lifetime rather than per read
+    if (status == STATUS_SUCCESS && db_io_is_direct()) {
+        cursor->direct = set_fd_direct(fd, true) == STATUS_SUCCESS;
+        if (!cursor->direct) {
+            // tmpfs and friends reject O_DIRECT, a cached read is still correct
+            report_errno("O_DIRECT unavailable, using cached reads");
+            db_io_set_direct(false);
+        }
+    }
+    size_t alloc = cursor->direct ? slot_size + 2 * DB_DIRECT_ALIGN : slot_size;
+    for (int i = 0; status == STATUS_SUCCESS && i < CURSOR_DEPTH; i++) {
+        if (posix_memalign((void**)&cursor->slots[i], DB_DIRECT_ALIGN, alloc) != 0) {
+            report_error("posix_memalign failed\n");
+            status = STATUS_ERROR;
+        }
+    }
+    for (int b = 0; status == STATUS_SUCCESS && b < CURSOR_DEPTH && b < cursor->nbatches; b++) {
+        status = submit(cursor, b);
+    }
+    if (status == STATUS_ERROR) {
+        db_cursor_close(cursor);
+        return STATUS_ERROR;
+    }
+    *cursorOut = cursor;
+    return STATUS_SUCCESS;
+}
+
+// the record stays valid until the next call; NULL once the records run out
+int db_cursor_next(struct db_cursor_t* cursor, const struct employee_t** employeeOut) {
+    for (;;) {
+        if (cursor->pos == cursor->batch_records) {
+            if (cursor->batch + 1 >= cursor->nbatches) {
+                *employeeOut = NULL;
+                return STATUS_SUCCESS;
+            }
+            if (begin_batch(cursor, cursor->batch + 1) == STATUS_ERROR) {
+                return STATUS_ERROR;
+            }
+        }
+        int i = cursor->pos++;
+        if (decode_employee(&cursor->records[i], cursor->names, &cursor->current) != STATUS_SUCCESS) {
+            int per_batch = is_compressed(cursor) ? COMPRESS_BLOCK_RECORDS : CURSOR_BATCH_RECORDS;
+            report_error("Checksum mismatch in record %d\n", cursor->batch * per_batch + i);
+            return STATUS_ERROR;
+        }
+        if (!(cursor->current.flags & EMPLOYEE_DELETED)) {
+            *employeeOut = &cursor->current;
+            return STATUS_SUCCESS;
+        }
+    }
+}
+
+void db_cursor_close(struct db_cursor_t* cursor) {
+    if (cursor == NULL) {
+        return;
+    }
+    // reads still in flight land in the slots, they must finish before those go
+    for (int b = cursor->batch + 1; b < cursor->submitted; b++) {
+        db_io_wait(cursor->fd, &cursor->ios[b % CURSOR_DEPTH], 1);
+    }
+    if (cursor->direct) {
+        set_fd_direct(cursor->fd, false);
+    }
+    for (int i = 0; i < CURSOR_DEPTH; i++) {
+        free(cursor->slots[i]);
+    }
+    free(cursor->block);
+    free(cursor->index);
+    strpool_free(cursor->names);
+    free(cursor);
+}
@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "common.h"
+#include "dbview.h"
+#include "error.h"
+#include "file.h"
+#include "parse.h"
+
+struct dbview_t {
+    char* path;
+    int fd;
+    bool read_only;
+    bool dirty;
+    // a reload after a commit failed: the table is gone or half loaded, or
+    // the lock is on the replaced inode; only dbview_close is left
+    bool failed;
+    struct db_header_t* header;
+    struct employee_t* employees;
+    struct dict_t* addresses;
+    struct strpool_t* names;
+    struct bloom_t* bloom;
+};
+
+static void unload(struct dbview_t* db) {
+    free(db->header);
+    free(db->employees);
+    dict_free(db->addresses);
+    strpool_free(db->names);
+    bloom_free(db->bloom);
+    db->header    = NULL;
+    db->employees = NULL;
+    db->addresses = NULL;
+    db->names     = NULL;
+    db->bloom     = NULL;
+}
+
+static void release(struct dbview_t* db) {
+    unload(db);
+    if (db->fd != -1) {
+        close(db->fd);
+    }
+    free(db->path);
+    free(db);
+}
+
+// the same steps a CLI run takes before it mutates anything
+static int load(struct dbview_t* db) {
+    if (retrieve_and_validate_db_header(db->fd, &db->header) == STATUS_ERROR ||
+        read_address_dict(db->fd, db->header, &db->addresses) == STATUS_ERROR || strpool_create(&db->names) == STATUS_ERROR ||
+        read_employees(db->fd, db->header, db->names, db->addresses, &db->employees) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    if (db->read_only) {
+        // the table is in memory, the snapshot needs neither the lock nor the fd
+        close(db->fd);
+        db->fd = -1;
+        return STATUS_SUCCESS;
+    }
+    if (read_name_bloom(db->fd, db->header, &db->bloom) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    if (db->bloom == NULL) {
+        unsigned int nbytes = db->header->bloom_bytes ? db->header->bloom_bytes : bloom_size(db->header->count * 2);
+        return build_name_bloom(db->header, db->employees, nbytes, &db->bloom);
+    }
+    return STATUS_SUCCESS;
+}
+
+// the new inode is locked before the old fd, and with it the old lock, goes
+static int reopen(struct dbview_t* db) {
+    int fd = db->read_only ? open_db_file_readonly(db->path, DB_LOCK_SNAPSHOT) : open_db_file(db->path, DB_LOCK_EXCLUSIVE);
+    if (fd == STATUS_ERROR) {
+        db->failed = true;
+        return STATUS_ERROR;
+    }
+    if (db->fd != -1) {
+        close(db->fd);
+    }
+    db->fd = fd;
+    unload(db);
+    if (load(db) == STATUS_ERROR) {
+        db->failed = true;
+        return STATUS_ERROR;
+    }
+    return STATUS_SUCCESS;
+}
+
+static int commit(struct dbview_t* db);
+
+static int create(struct dbview_t* db) {
+    db->fd = create_db_file(db->path);
+    if (db->fd == STATUS_ERROR || create_db_header(db->fd, &db->header) == STATUS_ERROR ||
+        dict_create(&db->addresses) == STATUS_ERROR || strpool_create(&db->names) == STATUS_ERROR ||
+        bloom_create(bloom_size(0), &db->bloom) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    db->employees = calloc(1, sizeof(struct employee_t));
+    if (db->employees == NULL) {
+        report_error("Calloc failed\n");
+        return STATUS_ERROR;
+    }
+    // whatever the path held before is replaced, never patched
+    db->header->flags |= DB_FLAG_REWRITE;
+    db->dirty = true;
+    return commit(db);
+}
+
+// the helpers report into the thread's message instead of onto stdout, which
+// belongs to the program that embeds us
+static void begin_call(void) {
+    error_capture(true);
+    error_clear();
+}
+
+static int misuse(const char* message) {
+    report_error("%s\n", message);
+    return DBVIEW_MISUSE;
+}
+
+static int not_found(const char* name) {
+    report_error("Employee not found: %s\n", name);
+    return DBVIEW_NOTFOUND;
+}
+
+static int check_handle(struct dbview_t* db) {
+    if (db == NULL) {
+        return misuse("Got a NULL handle");
+    }
+    if (db->failed) {
+        report_error("The database could not be reloaded after a commit, the handle can only be closed\n");
+        return DBVIEW_ERROR;
+    }
+    return DBVIEW_OK;
+}
+
+static int check_writable(struct dbview_t* db) {
+    int status = check_handle(db);
+    if (status != DBVIEW_OK) {
+        return status;
+    }
+    if (db->read_only) {
+        return misuse("The database was opened read-only");
+    }
+    return DBVIEW_OK;
+}
+
+int dbview_open(const char* path, int flags, struct dbview_t** dbOut) {
+    begin_call();
+    if (path == NULL || dbOut == NULL) {
+        return misuse("Got a NULL path or handle from the user");
+    }
+    if ((flags & DBVIEW_READONLY) && (flags & DBVIEW_CREATE)) {
+        return misuse("A read-only handle cannot create a database");
+    }
+    struct dbview_t* db = calloc(1, sizeof(struct dbview_t));
+    if (db == NULL) {
+        report_error("Calloc failed\n");
+        return DBVIEW_ERROR;
+    }
+    db->fd        = -1;
+    db->read_only = flags & DBVIEW_READONLY;
+    db->path      = strdup(path);
+    if (db->path == NULL) {
+        report_error("Malloc failed\n");
+        free(db);
+        return DBVIEW_ERROR;
+    }
+
+    int status = (flags & DBVIEW_CREATE) ? create(db) : reopen(db);
+    if (status == STATUS_ERROR) {
+        release(db);
+        return DBVIEW_ERROR;
+    }
+    *dbOut = db;
+    return DBVIEW_OK;
+}
+
+int dbview_count(struct dbview_t* db) {
+    begin_call();
+    int status = check_handle(db);
+    if (status != DBVIEW_OK) {
+        return status;
+    }
+    return db->header->count - db->header->deleted;
+}
+
+const char* dbview_errmsg(void) {
+    return error_last();
+}
+
+static void fill_record(struct dbview_t* db, const struct employee_t* e, struct dbview_record_t* out) {
+    out->name    = e->name;
+    out->address = dict_string(db->addresses, e->address_id);
+    out->hours   = e->hours;
+}
+
+// -1 when absent; the filter answers most misses without touching the table
+static int lookup(struct dbview_t* db, const char* name) {
+    if (db->bloom && !bloom_may_contain(db->bloom, name, strlen(name))) {
+        return -1;
+    }
+    return find_employee(db->header, db->employees, name);
+}
+
+int dbview_get(struct dbview_t* db, const char* name, struct dbview_record_t* out) {
+    begin_call();
+    int status = check_handle(db);
+    if (status != DBVIEW_OK) {
+        return status;
+    }
+    if (name == NULL || out == NULL) {
+        return misuse("Got a NULL name or record");
+    }
+    int index = lookup(db, name);
+    if (index == -1) {
+        return not_found(name);
+    }
+    fill_record(db, &db->employees[index], out);
+    return DBVIEW_OK;
+}
+
+int dbview_add(struct dbview_t* db, const char* name, const char* address, unsigned int hours) {
+    begin_call();
+    int status = check_writable(db);
+    if (status != DBVIEW_OK) {
+        return status;
+    }
+    if (name == NULL || address == NULL || name[0] == '\0') {
+        return misuse("An employee needs a name and an address");
+    }
+    struct employee_t e;
+    if (build_employee(name, address, hours, db->names, db->addresses, &e) == STATUS_ERROR ||
+        append_employee(db->header, &db->employees, &e) == STATUS_ERROR) {
+        return DBVIEW_ERROR;
+    }
+    // lookups before the next sync must find it
+    bloom_add(db->bloom, e.name, e.name_len);
+    db->dirty = true;
+    return DBVIEW_OK;
+}
+
+// a NULL address keeps the current one
+int dbview_update(struct dbview_t* db, const char* name, const char* address, unsigned int hours) {
+    begin_call();
+    int status = check_writable(db);
+    if (status != DBVIEW_OK) {
+        return status;
+    }
+    if (name == NULL) {
+        return misuse("Got a NULL name");
+    }
+    int index = lookup(db, name);
+    if (index == -1) {
+        return not_found(name);
+    }
+    struct employee_t* e = &db->employees[index];
+    if (address) {
+        char truncated[EMPLOYEE_NAME_MAX + 1] = { 0 };
+        strncpy(truncated, address, sizeof(truncated) - 1);
+        if (dict_intern(db->addresses, truncated, &e->address_id) == STATUS_ERROR) {
+            return DBVIEW_ERROR;
+        }
+    }
+    e->hours = hours;
+    e->flags |= EMPLOYEE_DIRTY;
+    db->dirty = true;
+    return DBVIEW_OK;
+}
+
+int dbview_delete(struct dbview_t* db, const char* name) {
+    begin_call();
+    int status = check_writable(db);
+    if (status != DBVIEW_OK) {
+        return status;
+    }
+    if (name == NULL) {
+        return misuse("Got a NULL name");
+    }
+    int index = lookup(db, name);
+    if (index == -1) {
+        return not_found(name);
+    }
+    // the tombstone delete_employee leaves, without scanning for the name again
+    db->employees[index].flags |= EMPLOYEE_DELETED | EMPLOYEE_DIRTY;
+    db->header->deleted++;
+    db->dirty = true;
+    return DBVIEW_OK;
+}
+
+int dbview_iterate(struct dbview_t* db, dbview_visit_t visit, void* ctx) {
+    begin_call();
+    int status = check_handle(db);
+    if (status != DBVIEW_OK) {
+        return status;
+    }
+    if (visit == NULL) {
+        return misuse("Got a NULL callback");
+    }
+    struct dbview_record_t record;
+    for (int i = 0; i < db->header->count; i++) {
+        if (db->employees[i].flags & EMPLOYEE_DELETED) {
+            continue;
+        }
+        fill_record(db, &db->employees[i], &record);
+        int stop = visit(&record, ctx);
+        if (stop) {
+            return stop;
+        }
+    }
+    return DBVIEW_OK;
+}
+
+// create() commits through here before the handle exists for the caller
+static int commit(struct dbview_t* db) {
+    if (!db->dirty) {
+        return STATUS_SUCCESS;
+    }
+    if (output_file(db->fd, db->path, db->header, db->employees, db->addresses, db->bloom) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    db->dirty = false;
+
+    // a full rewrite renamed a new image over the path, the handle follows it
+    struct stat dbstat = { 0 };
+    if (fstat(db->fd, &dbstat) == -1) {
+        report_errno("fstat");
+        return STATUS_ERROR;
+    }
+    if (dbstat.st_nlink == 0) {
+        return reopen(db);
+    }
+    return STATUS_SUCCESS;
+}
+
+int dbview_sync(struct dbview_t* db) {
+    begin_call();
+    int status = check_writable(db);
+    if (status != DBVIEW_OK) {
+        return status;
+    }
+    return commit(db) == STATUS_ERROR ? DBVIEW_ERROR : DBVIEW_OK;
+}
+
+int dbview_close(struct dbview_t* db) {
+    begin_call();
+    if (db == NULL) {
+        return DBVIEW_OK;
+    }
+    int status = db->read_only || db->failed ? STATUS_SUCCESS : commit(db);
+    release(db);
+    return status == STATUS_ERROR ? DBVIEW_ERROR : DBVIEW_OK;
+}
@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "dict.h"
+#include "error.h"
+
+#define DICT_MIN_SLOTS 64
+
+static unsigned int hash_string(const char* s) {
+    // FNV-1a
+    unsigned int h = 2166136261u;
+    for (; *s; s++) {
+        h = (h ^ (unsigned char)*s) * 16777619u;
+    }
+    return h;
+}
+
+static unsigned int* find_slot(const struct dict_t* dict, const char* s) {
+    unsigned int mask = dict->nslots - 1;
+    unsigned int i    = hash_string(s) & mask;
+    for (;; i = (i + 1) & mask) {
+        unsigned int slot = dict->slots[i];
+        if (slot == 0 || strcmp(dict->bytes + dict->offsets[slot - 1], s) == 0) {
+            return &dict->slots[i];
+        }
+    }
+}
+
+// keeps the table at most half full so probes stay short
+static int grow_slots(struct dict_t* dict) {
+    unsigned int nslots = dict->nslots ? dict->nslots * 2 : DICT_MIN_SLOTS;
+    unsigned int* slots = calloc(nslots, sizeof(unsigned int));
+    if (slots == NULL) {
+        report_error("Calloc failed\n");
+        return STATUS_ERROR;
+    }
+    free(dict->slots);
+    dict->slots  = slots;
+    dict->nslots = nslots;
+    for (unsigned int id = 0; id < dict->count; id++) {
+        unsigned int* slot = find_slot(dict, dict->bytes + dict->offsets[id]);
+        if (*slot == 0) {
+            *slot = id + 1;
+        }
+    }
+    return STATUS_SUCCESS;
+}
+
+int dict_create(struct dict_t** dictOut) {
+    struct dict_t* dict = calloc(1, sizeof(struct dict_t));
+    if (dict == NULL || grow_slots(dict) == STATUS_ERROR) {
+        report_error("Calloc failed\n");
+        free(dict);
+        return STATUS_ERROR;
+    }
+    *dictOut = dict;
+    return STATUS_SUCCESS;
+}
+
+static int append_string(struct dict_t* dict, const char* s, size_t len) {
+    if (dict->used + len + 1 > dict->size) {
+        unsigned int size = dict->size ? dict->size : 256;
+        while (size < dict->used + len + 1) {
+            size *= 2;
+        }
+        char* bytes = realloc(dict->bytes, size);
+        if (bytes == NULL) {
+            report_error("Realloc failed\n");
+            return STATUS_ERROR;
+        }
+        dict->bytes = bytes;
+        dict->size  = size;
+    }
+    unsigned int* offsets = realloc(dict->offsets, sizeof(unsigned int) * (dict->count + 1));
+    if (offsets == NULL) {
+        report_error("Realloc failed\n");
+        return STATUS_ERROR;
+    }
+    dict->offsets = offsets;
+
+    memcpy(dict->bytes + dict->used, s, len);
+    dict->bytes[dict->used + len] = '\0';
+    dict->offsets[dict->count++]  = dict->used;
+    dict->used += len + 1;
+    return STATUS_SUCCESS;
+}
+
+// the bytes come straight from disk, so every string must be terminated inside them
+int dict_load(const char* bytes, unsigned int used, unsigned int count, struct dict_t** dictOut) {
+    if (used > 0 && bytes[used - 1] != '\0') {
+        report_error("Unterminated dictionary\n");
+        return STATUS_ERROR;
+    }
+    struct dict_t* dict = NULL;
+    if (dict_create(&dict) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    unsigned int pos = 0;
+    while (pos < used) {
+        size_t len = strlen(bytes + pos);
+        if (append_string(dict, bytes + pos, len) == STATUS_ERROR) {
+            dict_free(dict);
+            return STATUS_ERROR;
+        }
+        pos += len + 1;
+    }
+    if (dict->count != count) {
+        report_error("Dictionary holds %u strings, header says %u\n", dict->count, count);
+        dict_free(dict);
+        return STATUS_ERROR;
+    }
+    unsigned int nslots = DICT_MIN_SLOTS;
+    while (nslots < count * 2) {
+        nslots *= 2;
+    }
+    dict->nslots = nslots / 2;
+    if (grow_slots(dict) == STATUS_ERROR) {
+        dict_free(dict);
+        return STATUS_ERROR;
+    }
+    *dictOut = dict;
+    return STATUS_SUCCESS;
+}
+
+int dict_lookup(const struct dict_t* dict, const char* s, unsigned int* idOut) {
+    unsigned int slot = *find_slot(dict, s);
+    if (slot == 0) {
+        return STATUS_ERROR;
+    }
+    *idOut = slot - 1;
+    return STATUS_SUCCESS;
+}
+
+int dict_intern(struct dict_t* dict, const char* s, unsigned int* idOut) {
+    if (dict_lookup(dict, s, idOut) == STATUS_SUCCESS) {
+        return STATUS_SUCCESS;
+    }
+    if ((dict->count + 1) * 2 > dict->nslots && grow_slots(dict) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    if (append_string(dict, s, strlen(s)) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    *idOut = dict->count - 1;
+    *find_slot(dict, s) = dict->count;
+    return STATUS_SUCCESS;
+}
+
+// an id the table does not hold reads as the empty string
+const char* dict_string(const struct dict_t* dict, unsigned int id) {
+    if (id >= dict->count) {
+        return "";
+    }
+    return dict->bytes + dict->offsets[id];
+}
+
+void dict_free(struct dict_t* dict) {
+    if (dict == NULL) {
+        return;
+    }
+    free(dict->bytes);
+    free(dict->offsets);
+    free(dict->slots);
+    free(dict);
+}
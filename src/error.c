@@ -0,0 +1,58 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "error.h"
+
+// both per thread: a library call turns capturing on for its own thread only,
+// and two threads on two handles never see each other's message
+static __thread bool capture = false;
+static __thread char last[ERROR_MESSAGE_MAX];
+
+void error_capture(bool enable) {
+    capture = enable;
+}
+
+void error_clear(void) {
+    last[0] = '\0';
+}
+
+const char* error_last(void) {
+    return last;
+}
+
+// the first failure is the cause, what the callers add on the way out is context
+static void keep(const char* message) {
+    if (last[0] != '\0') {
+        return;
+    }
+    snprintf(last, sizeof(last), "%s", message);
+    size_t len = strlen(last);
+    if (len > 0 && last[len - 1] == '\n') {
+        last[len - 1] = '\0';
+    }
+}
+
+void report_error(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    if (!capture) {
+        vprintf(fmt, args);
+        va_end(args);
+        return;
+    }
+    char message[ERROR_MESSAGE_MAX];
+    vsnprintf(message, sizeof(message), fmt, args);
+    va_end(args);
+    keep(message);
+}
+
+void report_errno(const char* what) {
+    if (!capture) {
+        perror(what);
+        return;
+    }
+    char message[ERROR_MESSAGE_MAX];
+    snprintf(message, sizeof(message), "%s: %s", what, strerror(errno));
+    keep(message);
+}
@@ -1,27 +1,658 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <errno.h>
+#include <stdbool.h>
 #include <fcntl.h>
+#include <libgen.h>
+#include <linux/fs.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include "common.h"
+#include "error.h"
 #include "file.h"
+#include "stats.h"
+
+// writers serialize on a single byte past the largest possible file; fcntl
+// range locks beyond EOF are legal and never touch the data itself
+#define DB_LOCK_WRITER_BYTE ((off_t)1 << 32)
+
+static int lock_range(int fd, short type, off_t start, off_t len) {
+    struct flock lock = { 0 };
+    lock.l_type       = type;
+    lock.l_whence     = SEEK_SET;
+    lock.l_start      = start;
+    lock.l_len        = len;
+
+    stats_syscall(SYSCALL_LOCK, 0);
+    // open file description locks survive other fds on the same file being closed
+    while (fcntl(fd, F_OFD_SETLKW, &lock) == -1) {
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EINVAL) {
+            while (fcntl(fd, F_SETLKW, &lock) == -1) {
+                if (errno != EINTR) {
+                    report_errno("fcntl");
+                    return STATUS_ERROR;
+                }
+            }
+            return STATUS_SUCCESS;
+        }
+        report_errno("fcntl");
+        return STATUS_ERROR;
+    }
+    return STATUS_SUCCESS;
+}
+
+// a writer that held the lock before us may have renamed a new image over
+// the path; the lock is only meaningful if we still hold the current inode
+static bool is_current_inode(int fd, const char* path) {
+    struct stat fdstat   = { 0 };
+    struct stat pathstat = { 0 };
+    if (fstat(fd, &fdstat) == -1 || stat(path, &pathstat) == -1) {
+        return false;
+    }
+    return fdstat.st_dev == pathstat.st_dev && fdstat.st_ino == pathstat.st_ino;
+}
+
+static int open_locked(const char* path, int flags, int lock_mode) {
+    for (;;) {
+        int fd = open(path, flags, 0644);
+        stats_syscall(SYSCALL_OPEN, 0);
+        if (fd == -1) {
+            report_errno("open");
+            return STATUS_ERROR;
+        }
+        if (lock_mode == DB_LOCK_SNAPSHOT) {
+            // commits rename a new inode into place, so the one we opened only
+            // changes under the pager's in-place writeback, which the data lock fences
+            if (lock_db_data(fd, false) == STATUS_ERROR) {
+                close(fd);
+                return STATUS_ERROR;
+            }
+            return fd;
+        }
+
+        short type = lock_mode == DB_LOCK_EXCLUSIVE ? F_WRLCK : F_RDLCK;
+        if (lock_range(fd, type, DB_LOCK_WRITER_BYTE, 1) == STATUS_ERROR) {
+            close(fd);
+            return STATUS_ERROR;
+        }
+        if (is_current_inode(fd, path)) {
+            return fd;
+        }
+        close(fd);
+    }
+}
+
+int lock_db_data(int fd, bool exclusive) {
+    return lock_range(fd, exclusive ? F_WRLCK : F_RDLCK, 0, DB_LOCK_WRITER_BYTE);
+}
+
+int unlock_db_data(int fd) {
+    return lock_range(fd, F_UNLCK, 0, DB_LOCK_WRITER_BYTE);
+}
 
 int create_db_file(const char* path) {
-    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    return open_locked(path, O_RDWR | O_CREAT, DB_LOCK_EXCLUSIVE);
+}
 
-    if (fd == -1) {
-        perror("open");
+int open_db_file(char* path, int lock_mode) {
+    return open_locked(path, O_RDWR, lock_mode);
+}
+
+// never writes, so it also works on read-only mounts and files we can't write
+int open_db_file_readonly(char* path, int lock_mode) {
+    if (lock_mode == DB_LOCK_EXCLUSIVE) {
+        report_error("A read-only open cannot take the writer lock\n");
         return STATUS_ERROR;
     }
+    return open_locked(path, O_RDONLY, lock_mode);
+}
 
-    return fd;
+int write_full(int fd, const void* buf, size_t len) {
+    const unsigned char* cursor = buf;
+    while (len > 0) {
+        ssize_t written = write(fd, cursor, len);
+        stats_syscall(SYSCALL_WRITE, written);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            report_errno("write");
+            return STATUS_ERROR;
+        }
+        cursor += written;
+        len -= written;
+    }
+    return STATUS_SUCCESS;
 }
 
-int open_db_file(char* path) {
-    int fd = open(path, O_RDWR);
+int create_temp_db_file(const char* path, char* tmppathOut, size_t size) {
+    // same directory as the target so the final rename never crosses filesystems
+    int written = snprintf(tmppathOut, size, "%s.XXXXXX", path);
+    if (written < 0 || (size_t)written >= size) {
+        report_error("Temp path too long for %s\n", path);
+        return STATUS_ERROR;
+    }
+    int fd = mkstemp(tmppathOut);
+    stats_syscall(SYSCALL_OPEN, 0);
     if (fd == -1) {
-        perror("open");
+        report_errno("mkstemp");
         return STATUS_ERROR;
     }
+    fchmod(fd, 0644);
     return fd;
 }
+
+int commit_temp_db_file(int tmpfd, const char* tmppath, const char* path) {
+    stats_syscall(SYSCALL_SYNC, 0);
+    if (fsync(tmpfd) == -1) {
+        report_errno("fsync");
+        close(tmpfd);
+        unlink(tmppath);
+        return STATUS_ERROR;
+    }
+    close(tmpfd);
+
+    stats_syscall(SYSCALL_OTHER, 0);
+    if (rename(tmppath, path) == -1) {
+        report_errno("rename");
+        unlink(tmppath);
+        return STATUS_ERROR;
+    }
+
+    // persist the directory entry as well, otherwise a crash can resurrect the old file
+    char dir[4096];
+    strncpy(dir, path, sizeof(dir) - 1);
+    dir[sizeof(dir) - 1] = '\0';
+    int dirfd            = open(dirname(dir), O_RDONLY | O_DIRECTORY);
+    stats_syscall(SYSCALL_OPEN, 0);
+    if (dirfd != -1) {
+        stats_syscall(SYSCALL_SYNC, 0);
+        fsync(dirfd);
+        close(dirfd);
+    }
+    return STATUS_SUCCESS;
+}
+
+static bool copy_unsupported(int err) {
+    return err == EXDEV || err == EINVAL || err == ENOSYS || err == EOPNOTSUPP || err == EBADF;
+}
+
+int export_db_range(int fd, off_t offset, size_t length, int out_fd) {
+    if (fd < 0 || out_fd < 0) {
+        report_error("Got a bad FD from the user\n");
+        return STATUS_ERROR;
+    }
+    off_t in_offset  = offset;
+    size_t remaining = length;
+
+    // in-kernel copy first; may even share extents on reflink capable filesystems
+    while (remaining > 0) {
+        ssize_t copied = copy_file_range(fd, &in_offset, out_fd, NULL, remaining, 0);
+        stats_syscall(SYSCALL_WRITE, copied);
+        if (copied == -1 && copy_unsupported(errno)) {
+            break;
+        }
+        if (copied <= 0) {
+            report_errno("copy_file_range");
+            return STATUS_ERROR;
+        }
+        remaining -= copied;
+    }
+
+    // copy_file_range refuses pipes and sockets, sendfile takes any output fd
+    while (remaining > 0) {
+        ssize_t copied = sendfile(out_fd, fd, &in_offset, remaining);
+        stats_syscall(SYSCALL_WRITE, copied);
+        if (copied == -1 && (errno == EINVAL || errno == ENOSYS)) {
+            break;
+        }
+        if (copied <= 0) {
+            report_errno("sendfile");
+            return STATUS_ERROR;
+        }
+        remaining -= copied;
+    }
+
+    // last resort for pipe outputs on kernels without sendfile to a pipe
+    while (remaining > 0) {
+        ssize_t copied = splice(fd, &in_offset, out_fd, NULL, remaining, SPLICE_F_MOVE);
+        stats_syscall(SYSCALL_WRITE, copied);
+        if (copied <= 0) {
+            report_errno("splice");
+            return STATUS_ERROR;
+        }
+        remaining -= copied;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+// A reflink shares every extent with the source, so the copy costs a few
+// metadata updates whatever the file size. Without one, copy_file_range runs
+// under the data read lock, which only holds off the in-place writers; commits
+// that rename a new image never wait for a snapshot.
+int snapshot_db_file(int fd, const char* dest) {
+    struct stat dbstat = { 0 };
+    if (fstat(fd, &dbstat) == -1) {
+        report_errno("fstat");
+        return STATUS_ERROR;
+    }
+
+    char tmppath[4096];
+    int tmpfd = create_temp_db_file(dest, tmppath, sizeof(tmppath));
+    if (tmpfd == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    if (lock_db_data(fd, false) == STATUS_ERROR) {
+        close(tmpfd);
+        unlink(tmppath);
+        return STATUS_ERROR;
+    }
+
+    int status = STATUS_SUCCESS;
+    stats_syscall(SYSCALL_OTHER, 0);
+    if (ioctl(tmpfd, FICLONE, fd) == -1) {
+        if (errno != EOPNOTSUPP && errno != EXDEV && errno != EINVAL && errno != ENOTTY && errno != EBADF) {
+            report_errno("ioctl FICLONE");
+            status = STATUS_ERROR;
+        } else {
+            status = export_db_range(fd, 0, dbstat.st_size, tmpfd);
+        }
+    }
+    unlock_db_data(fd);
+
+    if (status == STATUS_ERROR) {
+        close(tmpfd);
+        unlink(tmppath);
+        return STATUS_ERROR;
+    }
+    return commit_temp_db_file(tmpfd, tmppath, dest);
+}
+
+// A reflink of the whole file into a nameless file next to it, for a reader
+// that wants a fixed image without holding the data read lock while it works;
+// the caller holds that lock. STATUS_ERROR, with nothing reported, means the
+// directory or filesystem cannot do that, and the caller keeps the lock: a
+// full copy would cost more than the lock it saves.
+int pin_db_image(int fd, const char* path) {
+    char dir[4096];
+    strncpy(dir, path, sizeof(dir) - 1);
+    dir[sizeof(dir) - 1] = '\0';
+    int tmpfd            = open(dirname(dir), O_TMPFILE | O_RDWR, 0600);
+    stats_syscall(SYSCALL_OPEN, 0);
+    if (tmpfd == -1) {
+        return STATUS_ERROR;
+    }
+    stats_syscall(SYSCALL_OTHER, 0);
+    if (ioctl(tmpfd, FICLONE, fd) == -1) {
+        close(tmpfd);
+        return STATUS_ERROR;
+    }
+    return tmpfd;
+}
+
+// io_uring through the raw syscalls, so there is no liburing dependency
+#define DB_IO_RING_ENTRIES 64
+
+struct db_ring_t {
+    int fd;
+    unsigned entries;
+    unsigned inflight;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* sq_ptr;
+    void* cq_ptr;
+    size_t sq_size;
+    size_t cq_size;
+};
+
+static struct db_ring_t ring = { .fd = -1 };
+
+int db_io_setup(bool use_uring) {
+    if (!use_uring || ring.fd != -1) {
+        return STATUS_SUCCESS;
+    }
+
+    struct io_uring_params params = { 0 };
+    int fd                        = syscall(__NR_io_uring_setup, DB_IO_RING_ENTRIES, &params);
+    if (fd == -1) {
+        report_errno("io_uring_setup, falling back to pread/pwrite");
+        return STATUS_ERROR;
+    }
+
+    ring.sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring.sq_size = ring.cq_size > ring.sq_size ? ring.cq_size : ring.sq_size;
+        ring.cq_size = ring.sq_size;
+    }
+
+    ring.sq_ptr = mmap(NULL, ring.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring.sq_ptr == MAP_FAILED) {
+        report_errno("mmap");
+        close(fd);
+        return STATUS_ERROR;
+    }
+    ring.cq_ptr = ring.sq_ptr;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        ring.cq_ptr = mmap(NULL, ring.cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring.cq_ptr == MAP_FAILED) {
+            report_errno("mmap");
+            munmap(ring.sq_ptr, ring.sq_size);
+            close(fd);
+            return STATUS_ERROR;
+        }
+    }
+    ring.sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED) {
+        report_errno("mmap");
+        if (ring.cq_ptr != ring.sq_ptr) {
+            munmap(ring.cq_ptr, ring.cq_size);
+        }
+        munmap(ring.sq_ptr, ring.sq_size);
+        close(fd);
+        return STATUS_ERROR;
+    }
+
+    unsigned char* sq = ring.sq_ptr;
+    unsigned char* cq = ring.cq_ptr;
+    ring.sq_head      = (unsigned*)(sq + params.sq_off.head);
+    ring.sq_tail      = (unsigned*)(sq + params.sq_off.tail);
+    ring.sq_mask      = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring.sq_array     = (unsigned*)(sq + params.sq_off.array);
+    ring.cq_head      = (unsigned*)(cq + params.cq_off.head);
+    ring.cq_tail      = (unsigned*)(cq + params.cq_off.tail);
+    ring.cq_mask      = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring.cqes         = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    ring.entries      = params.sq_entries;
+    ring.inflight     = 0;
+    ring.fd           = fd;
+    return STATUS_SUCCESS;
+}
+
+static int ring_enter(unsigned to_submit, unsigned min_complete) {
+    for (;;) {
+        int ret = syscall(__NR_io_uring_enter, ring.fd, to_submit, min_complete, IORING_ENTER_GETEVENTS, NULL, 0);
+        stats_syscall(SYSCALL_RING_ENTER, 0);
+        if (ret >= 0) {
+            return ret;
+        }
+        if (errno != EINTR) {
+            report_errno("io_uring_enter");
+            return STATUS_ERROR;
+        }
+        // an interrupted enter may still have consumed submissions
+        to_submit = 0;
+    }
+}
+
+static void ring_reap(void) {
+    unsigned head = *ring.cq_head;
+    unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe* cqe = &ring.cqes[head & *ring.cq_mask];
+        struct db_io_t* io       = (struct db_io_t*)(uintptr_t)cqe->user_data;
+        io->result               = cqe->res;
+        io->done                 = true;
+        stats_bytes(io->write, io->result);
+        ring.inflight--;
+        head++;
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+}
+
+static int ring_wait_one(void) {
+    if (ring_enter(0, 1) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    ring_reap();
+    return STATUS_SUCCESS;
+}
+
+int db_io_submit(int fd, struct db_io_t* ios, int n, bool write) {
+    for (int i = 0; i < n; i++) {
+        ios[i].done   = false;
+        ios[i].result = 0;
+        ios[i].write  = write;
+    }
+
+    if (ring.fd == -1) {
+        for (int i = 0; i < n; i++) {
+            ios[i].result = write ? pwrite(fd, ios[i].buf, ios[i].len, ios[i].offset)
+                                  : pread(fd, ios[i].buf, ios[i].len, ios[i].offset);
+            stats_syscall(write ? SYSCALL_WRITE : SYSCALL_READ, ios[i].result);
+            if (ios[i].result == -1) {
+                ios[i].result = -errno;
+            }
+            ios[i].done = true;
+        }
+        return STATUS_SUCCESS;
+    }
+
+    int queued = 0;
+    for (int i = 0; i < n; i++) {
+        // keep completions from outrunning the ring, reaping into earlier ios
+        while (ring.inflight + queued >= ring.entries) {
+            if (queued > 0) {
+                if (ring_enter(queued, 0) == STATUS_ERROR) {
+                    return STATUS_ERROR;
+                }
+                ring.inflight += queued;
+                queued = 0;
+            }
+            if (ring_wait_one() == STATUS_ERROR) {
+                return STATUS_ERROR;
+            }
+        }
+
+        unsigned tail            = *ring.sq_tail;
+        unsigned index           = tail & *ring.sq_mask;
+        struct io_uring_sqe* sqe = &ring.sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode    = write ? IORING_OP_WRITE : IORING_OP_READ;
+        sqe->fd        = fd;
+        sqe->addr      = (uintptr_t)ios[i].buf;
+        sqe->len       = ios[i].len;
+        sqe->off       = ios[i].offset;
+        sqe->user_data = (uintptr_t)&ios[i];
+
+        ring.sq_array[index] = index;
+        __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+        queued++;
+    }
+
+    if (queued > 0) {
+        if (ring_enter(queued, 0) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+        ring.inflight += queued;
+    }
+    return STATUS_SUCCESS;
+}
+
+int db_io_wait(int fd, struct db_io_t* ios, int n) {
+    for (int i = 0; i < n; i++) {
+        while (!ios[i].done) {
+            if (ring_wait_one() == STATUS_ERROR) {
+                return STATUS_ERROR;
+            }
+        }
+    }
+
+    int status = STATUS_SUCCESS;
+    for (int i = 0; i < n; i++) {
+        struct db_io_t* io = &ios[i];
+        // old kernels reject IORING_OP_READ/WRITE, short transfers are finished here too
+        size_t done        = io->result > 0 ? io->result : 0;
+        if (io->allow_short && io->result >= 0) {
+            continue;
+        }
+        if (io->result < 0 && io->result != -EINVAL && io->result != -EOPNOTSUPP) {
+            errno = -io->result;
+            report_errno(io->write ? "pwrite" : "pread");
+            status = STATUS_ERROR;
+            continue;
+        }
+        while (done < io->len) {
+            unsigned char* buf = (unsigned char*)io->buf + done;
+            ssize_t moved      = io->write ? pwrite(fd, buf, io->len - done, io->offset + done)
+                                           : pread(fd, buf, io->len - done, io->offset + done);
+            stats_syscall(io->write ? SYSCALL_WRITE : SYSCALL_READ, moved);
+            if (moved <= 0) {
+                report_errno(io->write ? "pwrite" : "pread");
+                status = STATUS_ERROR;
+                break;
+            }
+            done += moved;
+        }
+        io->result = done;
+    }
+    return status;
+}
+
+int db_io_batch(int fd, struct db_io_t* ios, int n, bool write) {
+    if (db_io_submit(fd, ios, n, write) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    return db_io_wait(fd, ios, n);
+}
+
+static bool direct_io = false;
+
+void db_io_set_direct(bool enable) {
+    direct_io = enable;
+}
+
+bool db_io_is_direct(void) {
+    return direct_io;
+}
+
+int set_fd_direct(int fd, bool enable) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1) {
+        return STATUS_ERROR;
+    }
+    flags = enable ? flags | O_DIRECT : flags & ~O_DIRECT;
+    stats_syscall(SYSCALL_OTHER, 0);
+    return fcntl(fd, F_SETFL, flags) == -1 ? STATUS_ERROR : STATUS_SUCCESS;
+}
+
+// O_DIRECT wants block aligned buffers, offsets and lengths, so the range is
+// widened to DB_DIRECT_ALIGN and read through bounce buffers. DB_DIRECT_DEPTH
+// chunks stay in flight as our own read-ahead since the page cache does none.
+static int read_direct(int fd, void* dst, size_t len, off_t offset) {
+    off_t first = offset & ~((off_t)DB_DIRECT_ALIGN - 1);
+    off_t last  = (offset + len + DB_DIRECT_ALIGN - 1) & ~((off_t)DB_DIRECT_ALIGN - 1);
+    int nchunks = (last - first + DB_DIRECT_CHUNK - 1) / DB_DIRECT_CHUNK;
+
+    void* buffers[DB_DIRECT_DEPTH]         = { 0 };
+    struct db_io_t ios[DB_DIRECT_DEPTH]    = { 0 };
+    for (int i = 0; i < DB_DIRECT_DEPTH; i++) {
+        if (posix_memalign(&buffers[i], DB_DIRECT_ALIGN, DB_DIRECT_CHUNK) != 0) {
+            report_error("posix_memalign failed\n");
+            for (int j = 0; j < i; j++) {
+                free(buffers[j]);
+            }
+            return STATUS_ERROR;
+        }
+    }
+
+    int status    = STATUS_SUCCESS;
+    int submitted = 0;
+    for (int c = 0; c < nchunks && status == STATUS_SUCCESS; c++) {
+        while (submitted < nchunks && submitted < c + DB_DIRECT_DEPTH) {
+            struct db_io_t* io = &ios[submitted % DB_DIRECT_DEPTH];
+            off_t pos          = first + (off_t)submitted * DB_DIRECT_CHUNK;
+            io->buf            = buffers[submitted % DB_DIRECT_DEPTH];
+            io->offset         = pos;
+            io->len            = last - pos < DB_DIRECT_CHUNK ? last - pos : DB_DIRECT_CHUNK;
+            io->allow_short    = true;
+            if (db_io_submit(fd, io, 1, false) == STATUS_ERROR) {
+                status = STATUS_ERROR;
+                break;
+            }
+            submitted++;
+        }
+        struct db_io_t* io = &ios[c % DB_DIRECT_DEPTH];
+        if (status == STATUS_ERROR || db_io_wait(fd, io, 1) == STATUS_ERROR) {
+            status = STATUS_ERROR;
+            break;
+        }
+
+        // copy out the part of this chunk that overlaps the requested range
+        off_t from = io->offset > offset ? io->offset : offset;
+        off_t to   = io->offset + io->result;
+        to         = to < (off_t)(offset + len) ? to : (off_t)(offset + len);
+        if (to <= from && from < (off_t)(offset + len)) {
+            report_error("Short read at offset %lld\n", (long long)from);
+            status = STATUS_ERROR;
+            break;
+        }
+        if (to > from) {
+            memcpy((unsigned char*)dst + (from - offset), (unsigned char*)io->buf + (from - io->offset), to - from);
+        }
+    }
+
+    // reap whatever read-ahead is still in flight before its buffer goes away
+    for (int c = 0; c < submitted; c++) {
+        if (!ios[c % DB_DIRECT_DEPTH].done) {
+            db_io_wait(fd, &ios[c % DB_DIRECT_DEPTH], 1);
+        }
+    }
+    for (int i = 0; i < DB_DIRECT_DEPTH; i++) {
+        free(buffers[i]);
+    }
+    return status;
+}
+
+int read_scan(int fd, void* dst, size_t len, off_t offset) {
+    if (direct_io) {
+        if (set_fd_direct(fd, true) == STATUS_SUCCESS) {
+            int status = read_direct(fd, dst, len, offset);
+            set_fd_direct(fd, false);
+            return status;
+        }
+        // tmpfs and friends reject O_DIRECT, a cached read is still correct
+        report_errno("O_DIRECT unavailable, using cached reads");
+        direct_io = false;
+    }
+
+    posix_fadvise(fd, offset, len, POSIX_FADV_SEQUENTIAL);
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, (unsigned char*)dst + done, len - done, offset + done);
+        stats_syscall(SYSCALL_READ, n);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            report_errno("pread");
+            return STATUS_ERROR;
+        }
+        done += n;
+    }
+    return STATUS_SUCCESS;
+}
+
+void drop_scan_cache(int fd, off_t offset, size_t len) {
+    posix_fadvise(fd, offset, len, POSIX_FADV_DONTNEED);
+}
@@ -0,0 +1,164 @@
+#include <stdint.h>
+#include <string.h>
+#include "common.h"
+#include "lz.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 65535
+// the tail of a block is always literals, which keeps match copies in bounds
+#define LZ_LAST_LITERALS 5
+#define LZ_MATCH_LIMIT 12
+
+static uint32_t read32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash32(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+size_t lz_compress_bound(size_t len) {
+    return len + len / 255 + 16;
+}
+
+static unsigned char* write_length(unsigned char* op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+static unsigned char* write_sequence(unsigned char* op, const unsigned char* literals, size_t nliterals, size_t offset, size_t match) {
+    unsigned char* token = op++;
+    *token               = (nliterals >= 15 ? 15 : nliterals) << 4;
+    if (nliterals >= 15) {
+        op = write_length(op, nliterals - 15);
+    }
+    memcpy(op, literals, nliterals);
+    op += nliterals;
+
+    if (match == 0) {
+        return op;
+    }
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    match -= LZ_MIN_MATCH;
+    *token |= match >= 15 ? 15 : match;
+    if (match >= 15) {
+        op = write_length(op, match - 15);
+    }
+    return op;
+}
+
+// returns the compressed size, 0 if cap is below lz_compress_bound(len)
+size_t lz_compress(const void* src, size_t len, void* dst, size_t cap) {
+    if (cap < lz_compress_bound(len)) {
+        return 0;
+    }
+    const unsigned char* base   = src;
+    const unsigned char* ip     = base;
+    const unsigned char* anchor = base;
+    const unsigned char* end    = base + len;
+    unsigned char* op           = dst;
+
+    if (len > LZ_MATCH_LIMIT) {
+        const unsigned char* match_limit = end - LZ_MATCH_LIMIT;
+        const unsigned char* copy_limit  = end - LZ_LAST_LITERALS;
+        uint32_t table[1 << LZ_HASH_BITS];
+        memset(table, 0xff, sizeof(table));
+
+        while (ip < match_limit) {
+            uint32_t sequence        = read32(ip);
+            uint32_t h               = hash32(sequence);
+            uint32_t candidate       = table[h];
+            table[h]                 = ip - base;
+            const unsigned char* ref = base + candidate;
+            if (candidate == UINT32_MAX || ip - ref > LZ_MAX_OFFSET || read32(ref) != sequence) {
+                ip++;
+                continue;
+            }
+
+            size_t match = LZ_MIN_MATCH;
+            while (ip + match < copy_limit && ref[match] == ip[match]) {
+                match++;
+            }
+            op     = write_sequence(op, anchor, ip - anchor, ip - ref, match);
+            ip     = ip + match;
+            anchor = ip;
+        }
+    }
+
+    op = write_sequence(op, anchor, end - anchor, 0, 0);
+    return op - (unsigned char*)dst;
+}
+
+static int read_length(const unsigned char** ip, const unsigned char* iend, size_t* len) {
+    unsigned char b;
+    do {
+        if (*ip >= iend) {
+            return STATUS_ERROR;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return STATUS_SUCCESS;
+}
+
+// every length and offset is checked, so corrupt input fails instead of overrunning
+int lz_decompress(const void* src, size_t len, void* dst, size_t cap, size_t* lenOut) {
+    const unsigned char* ip   = src;
+    const unsigned char* iend = ip + len;
+    unsigned char* out        = dst;
+    unsigned char* op         = out;
+    unsigned char* oend       = out + cap;
+
+    while (ip < iend) {
+        unsigned char token = *ip++;
+        size_t nliterals    = token >> 4;
+        if (nliterals == 15 && read_length(&ip, iend, &nliterals) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+        if (nliterals > (size_t)(iend - ip) || nliterals > (size_t)(oend - op)) {
+            return STATUS_ERROR;
+        }
+        memcpy(op, ip, nliterals);
+        ip += nliterals;
+        op += nliterals;
+        if (ip == iend) {
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return STATUS_ERROR;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        size_t match = token & 15;
+        if (match == 15 && read_length(&ip, iend, &match) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - out) || match > (size_t)(oend - op)) {
+            return STATUS_ERROR;
+        }
+
+        const unsigned char* ref = op - offset;
+        if (offset >= match) {
+            memcpy(op, ref, match);
+            op += match;
+        } else {
+            // overlapping copy repeats the last offset bytes, as in a run of NULs
+            while (match-- > 0) {
+                *op++ = *ref++;
+            }
+        }
+    }
+
+    *lenOut = op - out;
+    return STATUS_SUCCESS;
+}
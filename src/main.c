@@ -3,11 +3,56 @@
 #include <stdbool.h>
 #include <getopt.h>
 
+#include "cursor.h"
 #include "file.h"
 #include "parse.h"
+#include "pager.h"
+#include "sort.h"
+#include "stats.h"
 #include "main.h"
 #include "common.h"
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+enum {
+    OPT_EXPORT_RAW = 256,
+    OPT_COMPACT,
+    OPT_VERIFY,
+    OPT_POOL,
+    OPT_IO_URING,
+    OPT_DIRECT,
+    OPT_STATS,
+    OPT_FORMAT,
+    OPT_SNAPSHOT,
+    OPT_COMPRESS,
+    OPT_DECOMPRESS,
+    OPT_COUNT,
+    OPT_INFO,
+    OPT_SORT,
+    OPT_TOP,
+    OPT_BY,
+};
+
+static struct option long_options[] = {
+    { "export-raw", required_argument, NULL, OPT_EXPORT_RAW },
+    { "compact", no_argument, NULL, OPT_COMPACT },
+    { "verify", no_argument, NULL, OPT_VERIFY },
+    { "pool", required_argument, NULL, OPT_POOL },
+    { "io-uring", no_argument, NULL, OPT_IO_URING },
+    { "direct", no_argument, NULL, OPT_DIRECT },
+    { "stats", no_argument, NULL, OPT_STATS },
+    { "format", required_argument, NULL, OPT_FORMAT },
+    { "snapshot", required_argument, NULL, OPT_SNAPSHOT },
+    { "compress", no_argument, NULL, OPT_COMPRESS },
+    { "decompress", no_argument, NULL, OPT_DECOMPRESS },
+    { "count", no_argument, NULL, OPT_COUNT },
+    { "info", no_argument, NULL, OPT_INFO },
+    { "sort", required_argument, NULL, OPT_SORT },
+    { "top", required_argument, NULL, OPT_TOP },
+    { "by", required_argument, NULL, OPT_BY },
+    { 0, 0, 0, 0 },
+};
 
 void print_usage(char* argv[]) {
     printf("Usage: %s [-n] -f filename\n", argv[0]);
@@ -16,26 +61,173 @@ void print_usage(char* argv[]) {
     printf("  -a addstring  Add data in name,address,hours format\n");
     printf("  -d            Delete the employee by name\n");
     printf("  -l            List the employees\n");
+    printf("  -q            Quiet, only print results and errors\n");
+    printf("  --format fmt  Listing format: text, json, tsv or binary (on-disk records)\n");
+    printf("  --sort field  List sorted by name, address or hours\n");
+    printf("  --top k       List the k employees with the most hours, or the greatest --by field\n");
+    printf("  --by field    Field --top ranks by: name, address or hours (default)\n");
+    printf("  --export-raw dest  Copy the raw record section to dest (- for stdout)\n");
+    printf("  --snapshot dest    Write a consistent copy of the database to dest\n");
+    printf("  --compact     Drop deleted records and rewrite the file\n");
+    printf("  --compress    Rewrite the records as compressed blocks\n");
+    printf("  --decompress  Rewrite the records uncompressed\n");
+    printf("  --verify      Check the checksum of every record\n");
+    printf("  --count       Print the number of live records, reading only the header\n");
+    printf("  --info        Print the header metadata, in --format text, json or tsv\n");
+    printf("  --pool pages  Work through a buffer pool of this many pages instead of loading the table\n");
+    printf("  --io-uring    Batch record reads and page writes through io_uring\n");
+    printf("  --direct      Scan with O_DIRECT instead of going through the page cache\n");
+    printf("  --stats       Print per-phase timings and I/O counters as JSON on stderr at exit\n");
     return;
 }
 
+// --sort collects every record and --top the best k of them before printing,
+// a plain listing prints records as they come
+struct listing_t {
+    int format;
+    int printed;
+    struct dict_t* addresses;
+    struct sorter_t* sorter;
+    struct topk_t* topk;
+};
+
+static int listing_begin(struct listing_t* listing, struct dict_t* addresses, int format, int sort_field, int top, int top_field) {
+    memset(listing, 0, sizeof(struct listing_t));
+    listing->format    = format;
+    listing->addresses = addresses;
+    if (top > 0) {
+        return topk_create(top_field, top, addresses, &listing->topk);
+    }
+    if (sort_field != SORT_NONE) {
+        return sorter_create(sort_field, addresses, &listing->sorter);
+    }
+    list_begin(format);
+    return STATUS_SUCCESS;
+}
+
+static int listing_add(struct listing_t* listing, const struct employee_t* e) {
+    if (listing->topk) {
+        return topk_add(listing->topk, e);
+    }
+    if (listing->sorter) {
+        return sorter_add(listing->sorter, e);
+    }
+    list_employee(e, listing->addresses, listing->format, listing->printed++);
+    return STATUS_SUCCESS;
+}
+
+// prints what was collected unless adding failed, and frees it either way
+static int listing_end(struct listing_t* listing, int status) {
+    if (listing->topk) {
+        status = status == STATUS_SUCCESS ? topk_list(listing->topk, listing->format) : status;
+        topk_free(listing->topk);
+    } else if (listing->sorter) {
+        status = status == STATUS_SUCCESS ? sorter_list(listing->sorter, listing->format) : status;
+        sorter_free(listing->sorter);
+    } else {
+        list_end(listing->format);
+    }
+    return status;
+}
+
+// a listing over a cursor, one batch of records in memory at a time besides
+// what --sort or --top collects
+static int stream_employees(int fd, struct db_header_t* header, struct listing_t* listing) {
+    struct db_cursor_t* cursor = NULL;
+    if (db_cursor_open(fd, header, &cursor) == STATUS_ERROR) {
+        return listing_end(listing, STATUS_ERROR);
+    }
+    const struct employee_t* e = NULL;
+    int status                 = STATUS_SUCCESS;
+    while ((status = db_cursor_next(cursor, &e)) == STATUS_SUCCESS && e != NULL) {
+        if ((status = listing_add(listing, e)) == STATUS_ERROR) {
+            break;
+        }
+    }
+    db_cursor_close(cursor);
+    return listing_end(listing, status);
+}
+
+static int list_table(struct db_header_t* header, struct employee_t* employees, struct listing_t* listing) {
+    int status = STATUS_SUCCESS;
+    for (int i = 0; i < header->count && status == STATUS_SUCCESS; i++) {
+        if (!(employees[i].flags & EMPLOYEE_DELETED)) {
+            status = listing_add(listing, &employees[i]);
+        }
+    }
+    return listing_end(listing, status);
+}
+
 int main(int argc, char* argv[]) {
     char* filepath             = NULL;
     char* addstring            = NULL;
     char* delete_employee_name = NULL;
+    char* export_path          = NULL;
+    char* snapshot_path        = NULL;
     bool newfile               = false;
     bool list                  = false;
     bool delete                = false;
+    bool compact               = false;
+    bool verify                = false;
+    bool count_only            = false;
+    bool info                  = false;
+    bool compress              = false;
+    bool decompress            = false;
+    int pool_frames            = 0;
+    bool use_uring             = false;
+    bool quiet                 = false;
+    int format                 = LIST_FORMAT_TEXT;
+    int sort_field             = SORT_NONE;
+    int top                    = 0;
+    int top_field              = SORT_BY_HOURS;
     int c;
     int db_fd                    = -1;
     struct db_header_t* header   = NULL;
     struct employee_t* employees = NULL;
+    struct dict_t* addresses     = NULL;
+    struct strpool_t* names      = NULL;
+    struct bloom_t* bloom        = NULL;
 
-    while ((c = getopt(argc, argv, "nf:a:d:l")) != -1) {
+    while ((c = getopt_long(argc, argv, "nf:a:d:lq", long_options, NULL)) != -1) {
         switch (c) {
         case 'n':
             newfile = true;
             break;
+        case 'q':
+            quiet = true;
+            break;
+        case OPT_FORMAT:
+            if (strcmp(optarg, "text") == 0) {
+                format = LIST_FORMAT_TEXT;
+            } else if (strcmp(optarg, "json") == 0) {
+                format = LIST_FORMAT_JSON;
+            } else if (strcmp(optarg, "tsv") == 0) {
+                format = LIST_FORMAT_TSV;
+            } else if (strcmp(optarg, "binary") == 0) {
+                format = LIST_FORMAT_BINARY;
+            } else {
+                fprintf(stderr, "Unknown format: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_SORT:
+            if (sort_field_parse(optarg, &sort_field) == STATUS_ERROR) {
+                return 1;
+            }
+            break;
+        case OPT_TOP:
+            top = atoi(optarg);
+            if (top <= 0) {
+                fprintf(stderr, "--top takes a positive count\n");
+                return 1;
+            }
+            list = true;
+            break;
+        case OPT_BY:
+            if (sort_field_parse(optarg, &top_field) == STATUS_ERROR) {
+                return 1;
+            }
+            break;
         case 'a':
             addstring = optarg;
             break;
@@ -49,6 +241,45 @@ int main(int argc, char* argv[]) {
             delete               = true;
             delete_employee_name = optarg;
             break;
+        case OPT_SNAPSHOT:
+            snapshot_path = optarg;
+            break;
+        case OPT_EXPORT_RAW:
+            export_path = optarg;
+            break;
+        case OPT_COMPACT:
+            compact = true;
+            break;
+        case OPT_COMPRESS:
+            compress = true;
+            break;
+        case OPT_DECOMPRESS:
+            decompress = true;
+            break;
+        case OPT_VERIFY:
+            verify = true;
+            break;
+        case OPT_COUNT:
+            count_only = true;
+            break;
+        case OPT_INFO:
+            info = true;
+            break;
+        case OPT_IO_URING:
+            use_uring = true;
+            break;
+        case OPT_DIRECT:
+            db_io_set_direct(true);
+            break;
+        case OPT_STATS:
+            stats_enable();
+            break;
+        case OPT_POOL:
+            pool_frames = atoi(optarg);
+            if (pool_frames <= 0) {
+                pool_frames = DB_POOL_DEFAULT_FRAMES;
+            }
+            break;
         default:
             fprintf(stderr, "Usage: %s [-n] -f filename\n", argv[0]);
             return 1;
@@ -61,49 +292,339 @@ int main(int argc, char* argv[]) {
         return 0;
     }
 
+    if (top > 0 && sort_field != SORT_NONE) {
+        printf("--top and --sort are mutually exclusive\n");
+        return STATUS_ERROR;
+    }
+
+    if (compress && decompress) {
+        printf("--compress and --decompress are mutually exclusive\n");
+        return STATUS_ERROR;
+    }
+
+    bool read_only = !newfile && !addstring && !delete && !compact && !compress && !decompress;
+
+    // these answer and exit before any change would be applied
+    if (!read_only && (count_only || info || export_path || snapshot_path || verify)) {
+        printf("--count, --info, --export-raw, --snapshot and --verify only read, they do not combine with -n, -a, -d, "
+               "--compact, --compress or --decompress\n");
+        return STATUS_ERROR;
+    }
+
+    // without a ring every batch falls back to pread/pwrite
+    db_io_setup(use_uring);
+
+    stats_phase_begin(PHASE_OPEN);
     if (newfile) {
         db_fd = create_db_file(filepath);
+        stats_phase_end(PHASE_OPEN);
         if (db_fd == STATUS_ERROR) {
             printf("Unable to create database file\n");
             return STATUS_ERROR;
         }
         create_db_header(db_fd, &header);
     } else {
-        db_fd = open_db_file(filepath);
+        // a run that ends in output_file must not race other writers, a run
+        // that only reads opens O_RDONLY and works on the snapshot it opened
+        if (read_only) {
+            db_fd = open_db_file_readonly(filepath, DB_LOCK_SNAPSHOT);
+        } else {
+            db_fd = open_db_file(filepath, DB_LOCK_EXCLUSIVE);
+        }
+        stats_phase_end(PHASE_OPEN);
         if (db_fd == STATUS_ERROR) {
             printf("Unable to open database file\n");
             return STATUS_ERROR;
         }
+        stats_phase_begin(PHASE_VALIDATE);
         int status = retrieve_and_validate_db_header(db_fd, &header);
+        stats_phase_end(PHASE_VALIDATE);
         if (status == STATUS_ERROR) {
             printf("Invalid database file\n");
             return STATUS_ERROR;
         }
     }
 
-    printf("Newfile: %d\n", newfile);
-    printf("Filepath: %s\n", filepath);
+    // monitoring polls these, they answer from the validated header alone
+    if (count_only || info) {
+        if (count_only) {
+            printf("%u\n", header->count - header->deleted);
+        }
+        if (info) {
+            print_db_info(header, format);
+        }
+        return STATUS_SUCCESS;
+    }
 
-    if (read_employees(db_fd, header, &employees) != STATUS_SUCCESS) {
-        printf("Failed to read employees");
-        return 0;
+    // the raw-record paths below only know the current layout
+    bool v1 = header->flags & DB_FLAG_V1;
+    if (v1 && (export_path || verify || pool_frames > 0)) {
+        printf("This is a version 1 file, any write (such as --compact) upgrades it first\n");
+        return STATUS_ERROR;
+    }
+
+    if (export_path) {
+        // the record section leaves the file as-is, nothing is loaded or rewritten
+        bool to_stdout = strcmp(export_path, "-") == 0;
+        int out_fd     = to_stdout ? STDOUT_FILENO : open(export_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out_fd == -1) {
+            perror("open");
+            return STATUS_ERROR;
+        }
+        // a compressed file exports its block index and blocks as stored
+        off_t offset  = header->data_offset;
+        size_t length = sizeof(struct employee_rec_t) * header->count;
+        if (header->flags & DB_FLAG_COMPRESSED) {
+            length = header->filesize - offset;
+        }
+        stats_phase_begin(PHASE_WRITE);
+        int status = export_db_range(db_fd, offset, length, out_fd);
+        stats_phase_end(PHASE_WRITE);
+        if (!to_stdout) {
+            close(out_fd);
+        }
+        return status;
+    }
+
+    if (snapshot_path) {
+        stats_phase_begin(PHASE_WRITE);
+        int status = snapshot_db_file(db_fd, snapshot_path);
+        stats_phase_end(PHASE_WRITE);
+        return status;
+    }
+
+    if (verify) {
+        struct verify_result_t result;
+        stats_phase_begin(PHASE_LOAD);
+        int status = verify_db_file(db_fd, header, &result);
+        stats_phase_end(PHASE_LOAD);
+        if (status == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+        if (!result.dict_ok) {
+            printf("Verified 0 records, address dictionary corrupt\n");
+        } else {
+            printf("Verified %d records, %d corrupt\n", result.records, result.corrupt);
+        }
+        if (!result.bloom_ok) {
+            printf("Name filter missing or corrupt, the next write rebuilds it\n");
+        }
+        return result.dict_ok && result.corrupt == 0 ? STATUS_SUCCESS : STATUS_ERROR;
+    }
+
+    stats_phase_begin(PHASE_LOAD);
+    int dict_status = newfile ? dict_create(&addresses) : read_address_dict(db_fd, header, &addresses);
+    stats_phase_end(PHASE_LOAD);
+    if (dict_status == STATUS_ERROR) {
+        printf("Failed to read the address dictionary\n");
+        return STATUS_ERROR;
+    }
+
+    // a filter that is missing or fails its checksum is rebuilt from the records below
+    if (!read_only) {
+        stats_phase_begin(PHASE_LOAD);
+        int bloom_status = newfile ? bloom_create(bloom_size(0), &bloom) : read_name_bloom(db_fd, header, &bloom);
+        stats_phase_end(PHASE_LOAD);
+        if (bloom_status == STATUS_ERROR) {
+            printf("Failed to read the name filter\n");
+            return STATUS_ERROR;
+        }
+    }
+
+    // a name the filter never saw needs no records read to be reported missing,
+    // unless this run adds it first
+    if (delete && !addstring && bloom && !bloom_may_contain(bloom, delete_employee_name, strlen(delete_employee_name))) {
+        printf("Employee not found: %s\n", delete_employee_name);
+        delete = false;
+        if (!list && !compact && !compress && !decompress) {
+            return STATUS_SUCCESS;
+        }
+    }
+
+    // compressed and v1 files are compacted by the full rewrite in output_file,
+    // and so is a compaction that comes with other changes, after applying them
+    bool compressed   = header->flags & DB_FLAG_COMPRESSED;
+    bool compact_only = !addstring && !delete && !list && !compress && !decompress && pool_frames == 0;
+    if (compact && compact_only && !compressed && !v1) {
+        stats_phase_begin(PHASE_WRITE);
+        int status = compact_db_file(db_fd, filepath, header, addresses);
+        stats_phase_end(PHASE_WRITE);
+        return status;
+    }
+
+    // anything but text output is meant for another program, keep it clean
+    quiet = quiet || format != LIST_FORMAT_TEXT;
+    if (!quiet) {
+        printf("Newfile: %d\n", newfile);
+        printf("Filepath: %s\n", filepath);
+    }
+    if (!quiet && addstring) {
+        printf("Trying to add the following information into the datbase:\n%s\n", addstring);
+    }
+
+    if (pool_frames > 0 && (sort_field != SORT_NONE || top > 0)) {
+        printf("--sort and --top work on the whole table, not through --pool\n");
+        return STATUS_ERROR;
+    }
+
+    if (pool_frames > 0 && (compressed || compress)) {
+        printf("The buffer pool works on uncompressed files only\n");
+        return STATUS_ERROR;
+    }
+
+    if (pool_frames > 0) {
+        // only the pages an operation touches are read, only dirty ones written back
+        // a run that only lists never looks at the filter, so it is neither read nor rebuilt
+        struct pager_t* pager = NULL;
+        unsigned int bloom_bytes = header->bloom_bytes ? header->bloom_bytes : bloom_size(header->count * 2);
+        if (bloom == NULL && !read_only && scan_name_bloom(db_fd, header, bloom_bytes, &bloom) != STATUS_SUCCESS) {
+            printf("Failed to rebuild the name filter\n");
+            return STATUS_ERROR;
+        }
+        if (pager_open(db_fd, header, addresses, bloom, pool_frames, &pager) != STATUS_SUCCESS) {
+            return STATUS_ERROR;
+        }
+        stats_phase_begin(PHASE_MUTATE);
+        // a rejected add leaves the file as it was
+        if (addstring && pager_add_employee(pager, addstring) == STATUS_ERROR) {
+            pager_close(pager);
+            return STATUS_ERROR;
+        }
+        stats_phase_end(PHASE_MUTATE);
+        if (list) {
+            stats_phase_begin(PHASE_LIST);
+            pager_list_employees(pager, format);
+            stats_phase_end(PHASE_LIST);
+        }
+        stats_phase_begin(PHASE_MUTATE);
+        if (delete && pager_delete_employee(pager, delete_employee_name) == STATUS_SUCCESS && !quiet) {
+            printf("Deleting User: %s\n", delete_employee_name);
+        }
+        stats_phase_end(PHASE_MUTATE);
+        if (!quiet) {
+            printf("Latest count: %d\n", header->count - header->deleted);
+        }
+
+        stats_phase_begin(PHASE_WRITE);
+        int status = pager_flush(pager);
+        pager_close(pager);
+        // a dictionary that outgrew its room, or a filter the table outgrew,
+        // moves the records along with the compaction
+        bool rewrite = !read_only && (compact || needs_compaction(header) || !dict_fits(header, addresses) || !bloom_fits(header, bloom));
+        if (status == STATUS_SUCCESS && rewrite) {
+            status = compact_db_file(db_fd, filepath, header, addresses);
+        }
+        stats_phase_end(PHASE_WRITE);
+        return status;
+    }
+
+    // the heap never needs more room than the table, plus the one record -a adds
+    if (top > header->count + 1) {
+        top = header->count + 1;
+    }
+
+    if (read_only) {
+        // nothing is written back, so the records stream through a cursor instead
+        // of being loaded; memory stays flat however large the file. A v1 file
+        // is loaded, it only gets its current form in memory
+        int status = STATUS_SUCCESS;
+        if (list) {
+            struct listing_t listing;
+            stats_phase_begin(PHASE_LIST);
+            status = listing_begin(&listing, addresses, format, sort_field, top, top_field);
+            if (status == STATUS_SUCCESS && v1) {
+                status = strpool_create(&names) == STATUS_ERROR ? STATUS_ERROR : read_employees(db_fd, header, names, addresses, &employees);
+                status = status == STATUS_ERROR ? listing_end(&listing, status) : list_table(header, employees, &listing);
+            } else if (status == STATUS_SUCCESS && compressed) {
+                // a compressed image is only ever replaced by a rename, never
+                // written in place, so the inode we opened is already fixed
+                unlock_db_data(db_fd);
+                status = stream_employees(db_fd, header, &listing);
+            } else if (status == STATUS_SUCCESS) {
+                // the listing must show one commit; a reflink pins it so a slow
+                // reader of our output does not hold off in-place writers, and
+                // without one the lock stays held until the scan is done
+                int pinned = pin_db_image(db_fd, filepath);
+                if (pinned != STATUS_ERROR) {
+                    unlock_db_data(db_fd);
+                }
+                status = stream_employees(pinned != STATUS_ERROR ? pinned : db_fd, header, &listing);
+                if (pinned != STATUS_ERROR) {
+                    close(pinned);
+                }
+            }
+            stats_phase_end(PHASE_LIST);
+        }
+        unlock_db_data(db_fd);
+        return status;
+    }
+
+    stats_phase_begin(PHASE_LOAD);
+    if (strpool_create(&names) != STATUS_SUCCESS || read_employees(db_fd, header, names, addresses, &employees) != STATUS_SUCCESS) {
+        printf("Failed to read employees\n");
+        return STATUS_ERROR;
     };
+    stats_phase_end(PHASE_LOAD);
+
+    if (bloom == NULL) {
+        unsigned int bloom_bytes = header->bloom_bytes ? header->bloom_bytes : bloom_size(header->count * 2);
+        if (build_name_bloom(header, employees, bloom_bytes, &bloom) != STATUS_SUCCESS) {
+            printf("Failed to rebuild the name filter\n");
+            return STATUS_ERROR;
+        }
+    }
 
+    stats_phase_begin(PHASE_MUTATE);
+    if (compress) {
+        header->flags |= DB_FLAG_COMPRESSED | DB_FLAG_REWRITE;
+    }
+    if (decompress && compressed) {
+        header->flags &= ~DB_FLAG_COMPRESSED;
+        header->flags |= DB_FLAG_REWRITE;
+    }
+    if (compact) {
+        header->flags |= DB_FLAG_COMPACT;
+    }
     if (addstring) {
-        add_employee(header, &employees, addstring);
+        if (add_employee(header, &employees, names, addresses, addstring) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
     }
+    stats_phase_end(PHASE_MUTATE);
 
     if (list) {
-        list_employees(header, employees);
+        stats_phase_begin(PHASE_LIST);
+        struct listing_t listing;
+        if (listing_begin(&listing, addresses, format, sort_field, top, top_field) == STATUS_SUCCESS) {
+            list_table(header, employees, &listing);
+        }
+        stats_phase_end(PHASE_LIST);
     }
 
-    if (delete) {
-        delete_employee(header, &employees, delete_employee_name);
+    stats_phase_begin(PHASE_MUTATE);
+    if (delete && delete_employee(header, &employees, delete_employee_name) == STATUS_SUCCESS && !quiet) {
+        printf("Deleting User: %s\n", delete_employee_name);
     }
+    stats_phase_end(PHASE_MUTATE);
 
-    printf("Latest count: %d\n", header->count);
+    if (!quiet) {
+        printf("Latest count: %d\n", header->count - header->deleted);
+    }
+    if (!quiet && (compact || needs_compaction(header))) {
+        printf("Compacting %d deleted of %d records\n", header->deleted, header->count);
+    }
 
-    output_file(db_fd, header, employees);
+    stats_phase_begin(PHASE_WRITE);
+    int status = output_file(db_fd, filepath, header, employees, addresses, bloom);
+    stats_phase_end(PHASE_WRITE);
+    if (status != STATUS_SUCCESS) {
+        printf("Failed to write database file\n");
+        return STATUS_ERROR;
+    }
+    if (!quiet) {
+        // an in-place commit writes a few pages, so report the size rather than a count
+        printf("File is %u bytes\n", header->filesize);
+    }
 
     return STATUS_SUCCESS;
 }
@@ -0,0 +1,100 @@
+#include <string.h>
+#include "namematch.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NAMEMATCH_HAVE_X86 1
+#define SSE42_MODE (_SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_EACH | _SIDD_NEGATIVE_POLARITY)
+#endif
+
+typedef bool (*match_fn)(const char* field, const char* query, size_t len);
+
+void name_query_init(struct name_query_t* query, const char* name) {
+    memset(query->padded, 0, sizeof(query->padded));
+    query->len = strlen(name);
+    if (query->len < NAME_FIELD_SIZE) {
+        memcpy(query->padded, name, query->len);
+    }
+}
+
+// a field matches when its first len bytes are the name and the next one is NUL
+static bool match_scalar(const char* field, const char* query, size_t len) {
+    return memcmp(field, query, len) == 0 && field[len] == '\0';
+}
+
+#ifdef NAMEMATCH_HAVE_X86
+// pcmpistri stops at the first NUL of either operand, so one chunk compare
+// covers the terminator as well; both buffers are NAME_FIELD_SIZE long
+__attribute__((target("sse4.2"))) static bool match_sse42(const char* field, const char* query, size_t len) {
+    for (size_t off = 0; off <= len; off += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(field + off));
+        __m128i b = _mm_loadu_si128((const __m128i*)(query + off));
+        if (_mm_cmpistrc(a, b, SSE42_MODE)) {
+            return false;
+        }
+        if (_mm_cmpistrz(a, b, SSE42_MODE)) {
+            return true;
+        }
+    }
+    return true;
+}
+
+// 32 bytes per compare, the mask keeps only the name and its terminator
+__attribute__((target("avx2"))) static bool match_avx2(const char* field, const char* query, size_t len) {
+    size_t n = len + 1;
+    for (size_t off = 0; off < n; off += 32) {
+        __m256i a         = _mm256_loadu_si256((const __m256i*)(field + off));
+        __m256i b         = _mm256_loadu_si256((const __m256i*)(query + off));
+        unsigned int eq   = _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+        size_t remain     = n - off;
+        unsigned int need = remain >= 32 ? 0xffffffffu : (1u << remain) - 1;
+        if ((eq & need) != need) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+static match_fn select_match(void) {
+#ifdef NAMEMATCH_HAVE_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return match_avx2;
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return match_sse42;
+    }
+#endif
+    return match_scalar;
+}
+
+static match_fn match_impl(void) {
+    static match_fn impl = NULL;
+    if (impl == NULL) {
+        impl = select_match();
+    }
+    return impl;
+}
+
+bool name_query_match(const struct name_query_t* query, const char* field) {
+    if (query->len >= NAME_FIELD_SIZE) {
+        return false;
+    }
+    return match_impl()(field, query->padded, query->len);
+}
+
+// index of the first of n records, stride bytes apart with the name field at
+// offset 0, whose name matches; -1 when none does
+int name_query_scan(const struct name_query_t* query, const void* records, size_t stride, int n) {
+    if (query->len >= NAME_FIELD_SIZE) {
+        return -1;
+    }
+    match_fn match = match_impl();
+    const char* p  = records;
+    for (int i = 0; i < n; i++, p += stride) {
+        if (match(p, query->padded, query->len)) {
+            return i;
+        }
+    }
+    return -1;
+}
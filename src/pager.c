@@ -0,0 +1,367 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include <unistd.h>
+#include "common.h"
+#include "error.h"
+#include "file.h"
+#include "namematch.h"
+#include "pager.h"
+#include "stats.h"
+
+int pager_open(int fd, struct db_header_t* header, struct dict_t* addresses, struct bloom_t* bloom, int nframes, struct pager_t** pagerOut) {
+    if (fd < 0 || nframes <= 0) {
+        report_error("Got a bad FD or pool size from the user\n");
+        return STATUS_ERROR;
+    }
+    // pages map to fixed record offsets, which compressed blocks do not have
+    if (header->flags & DB_FLAG_COMPRESSED) {
+        report_error("Cannot page a compressed database\n");
+        return STATUS_ERROR;
+    }
+    if (header->flags & DB_FLAG_V1) {
+        report_error("Cannot page a version 1 database\n");
+        return STATUS_ERROR;
+    }
+    struct pager_t* pager = calloc(1, sizeof(struct pager_t));
+    if (pager == NULL) {
+        report_error("Calloc failed\n");
+        return STATUS_ERROR;
+    }
+    pager->frames = calloc(nframes, sizeof(struct pager_frame_t));
+    if (pager->frames == NULL) {
+        report_error("Calloc failed\n");
+        free(pager);
+        return STATUS_ERROR;
+    }
+    pager->fd      = fd;
+    pager->header    = header;
+    pager->addresses = addresses;
+    pager->bloom     = bloom;
+    pager->nframes   = nframes;
+    for (int i = 0; i < nframes; i++) {
+        pager->frames[i].page = -1;
+    }
+
+    *pagerOut = pager;
+    return STATUS_SUCCESS;
+}
+
+static off_t page_offset(struct pager_t* pager, int page) {
+    return pager->header->data_offset + (off_t)page * RECORDS_PER_PAGE * sizeof(struct employee_rec_t);
+}
+
+// records of this page that exist, either on disk or appended since
+static int page_records(struct pager_t* pager, int page) {
+    int first = page * RECORDS_PER_PAGE;
+    int n     = pager->header->count - first;
+    return n < (int)RECORDS_PER_PAGE ? n : (int)RECORDS_PER_PAGE;
+}
+
+// every name written out goes into the filter, whether it is new or not
+static size_t encode_page(struct pager_t* pager, struct pager_frame_t* frame, struct employee_rec_t* disk_records) {
+    int n = page_records(pager, frame->page);
+    for (int i = 0; i < n; i++) {
+        encode_employee(&frame->records[i], &disk_records[i]);
+        bloom_add(pager->bloom, frame->records[i].name, frame->records[i].name_len);
+    }
+    return sizeof(struct employee_rec_t) * n;
+}
+
+// a pool whose frames are all dirty takes one more; dirty pages only reach the
+// file with the header that commits them
+static struct pager_frame_t* grow_pool(struct pager_t* pager) {
+    struct pager_frame_t* frames = realloc(pager->frames, (pager->nframes + 1) * sizeof(struct pager_frame_t));
+    if (frames == NULL) {
+        report_error("Realloc failed\n");
+        return NULL;
+    }
+    pager->frames                 = frames;
+    struct pager_frame_t* frame   = &frames[pager->nframes++];
+    memset(frame, 0, sizeof(struct pager_frame_t));
+    frame->page                   = -1;
+    return frame;
+}
+
+// CLOCK: sweep the hand, giving every referenced frame a second chance; dirty
+// frames are pinned until pager_flush, writing one back earlier would put a
+// tombstone or an update on disk ahead of the header that counts it
+static struct pager_frame_t* evict_frame(struct pager_t* pager) {
+    // two sweeps clear every reference bit, a third finding nothing means all are dirty
+    for (int swept = 0; swept < 2 * pager->nframes + 1; swept++) {
+        struct pager_frame_t* frame = &pager->frames[pager->hand];
+        pager->hand                 = (pager->hand + 1) % pager->nframes;
+        if (frame->page == -1) {
+            return frame;
+        }
+        if (frame->dirty) {
+            continue;
+        }
+        if (frame->referenced) {
+            frame->referenced = false;
+            continue;
+        }
+        frame->page = -1;
+        return frame;
+    }
+    return grow_pool(pager);
+}
+
+static struct pager_frame_t* fetch_page(struct pager_t* pager, int page) {
+    for (int i = 0; i < pager->nframes; i++) {
+        if (pager->frames[i].page == page) {
+            pager->hits++;
+            pager->frames[i].referenced = true;
+            return &pager->frames[i];
+        }
+    }
+    pager->misses++;
+
+    struct pager_frame_t* frame = evict_frame(pager);
+    if (frame == NULL) {
+        return NULL;
+    }
+    if (frame->records == NULL) {
+        frame->records = calloc(RECORDS_PER_PAGE, sizeof(struct employee_t));
+        if (frame->records == NULL || strpool_create(&frame->names) == STATUS_ERROR) {
+            report_error("Calloc failed\n");
+            free(frame->records);
+            frame->records = NULL;
+            return NULL;
+        }
+    }
+    strpool_reset(frame->names);
+
+    struct employee_rec_t disk_records[RECORDS_PER_PAGE];
+    int n              = page_records(pager, page);
+    size_t nbytes      = sizeof(struct employee_rec_t) * n;
+    ssize_t bytes_read = pread(pager->fd, disk_records, nbytes, page_offset(pager, page));
+    stats_syscall(SYSCALL_READ, bytes_read);
+    if (bytes_read != (ssize_t)nbytes) {
+        report_errno("pread");
+        return NULL;
+    }
+    for (int i = 0; i < n; i++) {
+        if (decode_employee(&disk_records[i], frame->names, &frame->records[i]) != STATUS_SUCCESS) {
+            report_error("Checksum mismatch in record %d\n", page * (int)RECORDS_PER_PAGE + i);
+            return NULL;
+        }
+    }
+
+    frame->page       = page;
+    frame->dirty      = false;
+    frame->referenced = true;
+    return frame;
+}
+
+// the returned record is only valid until the next pager call
+struct employee_t* pager_get(struct pager_t* pager, int index, bool for_write) {
+    if (index < 0 || index >= pager->header->count) {
+        return NULL;
+    }
+    struct pager_frame_t* frame = fetch_page(pager, index / RECORDS_PER_PAGE);
+    if (frame == NULL) {
+        return NULL;
+    }
+    if (for_write) {
+        frame->dirty         = true;
+        pager->header_dirty  = true;
+    }
+    return &frame->records[index % RECORDS_PER_PAGE];
+}
+
+// copies e into a new slot, its name is interned into the frame that holds it
+struct employee_t* pager_append(struct pager_t* pager, const struct employee_t* e) {
+    int index = pager->header->count;
+    int page  = index / RECORDS_PER_PAGE;
+
+    // the new slot is not on disk yet, so only fetch the part of the page that is
+    struct pager_frame_t* frame = fetch_page(pager, page);
+    if (frame == NULL) {
+        return NULL;
+    }
+    struct employee_t* slot = &frame->records[index % RECORDS_PER_PAGE];
+    *slot                   = *e;
+    slot->name              = strpool_intern(frame->names, e->name, e->name_len, e->name_hash);
+    if (slot->name == NULL) {
+        return NULL;
+    }
+    // a lookup later in the same run must see the name before it is written out
+    bloom_add(pager->bloom, slot->name, slot->name_len);
+    pager->header->count++;
+    frame->dirty        = true;
+    pager->header_dirty = true;
+    return slot;
+}
+
+int pager_flush(struct pager_t* pager) {
+    if (!pager->header_dirty) {
+        return STATUS_SUCCESS;
+    }
+
+    // every dirty page goes out in one batch
+    struct employee_rec_t* pages = calloc((size_t)pager->nframes * RECORDS_PER_PAGE, sizeof(struct employee_rec_t));
+    // more slots for the strings appended to the dictionary and the changed filter pages
+    struct db_io_t* ios          = calloc(pager->nframes + 1 + bloom_pages(pager->bloom), sizeof(struct db_io_t));
+    if (pages == NULL || ios == NULL) {
+        report_error("Calloc failed\n");
+        free(pages);
+        free(ios);
+        return STATUS_ERROR;
+    }
+    int n = 0;
+    for (int i = 0; i < pager->nframes; i++) {
+        struct pager_frame_t* frame = &pager->frames[i];
+        if (frame->page == -1 || !frame->dirty) {
+            continue;
+        }
+        ios[n].buf    = pages + (size_t)i * RECORDS_PER_PAGE;
+        ios[n].len    = encode_page(pager, frame, ios[n].buf);
+        ios[n].offset = page_offset(pager, frame->page);
+        n++;
+    }
+
+    // a dictionary that outgrew its room, or a filter that the table outgrew, is
+    // left to the rewrite by compact_db_file, so the header stays as it is and
+    // the appended pages stay uncommitted
+    struct db_header_t* header = pager->header;
+    bool in_place              = dict_fits(header, pager->addresses) && bloom_fits(header, pager->bloom);
+    int status                 = commit_in_place(pager->fd, header, pager->addresses, pager->bloom, ios, n, in_place);
+    free(pages);
+    free(ios);
+    if (status == STATUS_SUCCESS) {
+        for (int i = 0; i < pager->nframes; i++) {
+            pager->frames[i].dirty = false;
+        }
+        pager->writebacks += n;
+        pager->header_dirty = !in_place;
+    }
+    return status;
+}
+
+void pager_close(struct pager_t* pager) {
+    if (pager == NULL) {
+        return;
+    }
+    stats_pool(pager->hits, pager->misses, pager->writebacks);
+    for (int i = 0; i < pager->nframes; i++) {
+        free(pager->frames[i].records);
+        strpool_free(pager->frames[i].names);
+    }
+    free(pager->frames);
+    free(pager);
+}
+
+int pager_add_employee(struct pager_t* pager, char* addstring) {
+    if (pager->header->count == USHRT_MAX) {
+        report_error("Database is full at %u records\n", pager->header->count);
+        return STATUS_ERROR;
+    }
+    struct strpool_t* names = NULL;
+    if (strpool_create(&names) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    struct employee_t parsed;
+    int status = parse_employee(addstring, names, pager->addresses, &parsed);
+    if (status == STATUS_SUCCESS && pager_append(pager, &parsed) == NULL) {
+        status = STATUS_ERROR;
+    }
+    strpool_free(names);
+    return status;
+}
+
+// pages in the pool are searched as decoded, the others are scanned raw with the
+// vector name kernel, neither decoded nor cached; -1 when absent, -2 on error
+static int find_in_page(struct pager_t* pager, int page, const struct name_query_t* query, unsigned int hash) {
+    int first = page * RECORDS_PER_PAGE;
+    int n     = page_records(pager, page);
+    for (int f = 0; f < pager->nframes; f++) {
+        struct pager_frame_t* frame = &pager->frames[f];
+        if (frame->page != page) {
+            continue;
+        }
+        for (int i = 0; i < n; i++) {
+            struct employee_t* e = &frame->records[i];
+            if (!(e->flags & EMPLOYEE_DELETED) && employee_has_name(e, query->padded, query->len, hash)) {
+                return first + i;
+            }
+        }
+        return -1;
+    }
+
+    struct employee_rec_t disk_records[RECORDS_PER_PAGE];
+    size_t nbytes      = sizeof(struct employee_rec_t) * n;
+    ssize_t bytes_read = pread(pager->fd, disk_records, nbytes, page_offset(pager, page));
+    stats_syscall(SYSCALL_READ, bytes_read);
+    if (bytes_read != (ssize_t)nbytes) {
+        report_errno("pread");
+        return -2;
+    }
+    for (int i = 0; i < n;) {
+        int match = name_query_scan(query, disk_records + i, sizeof(struct employee_rec_t), n - i);
+        if (match == -1) {
+            break;
+        }
+        i += match;
+        if (!(ntohl(disk_records[i].flags) & EMPLOYEE_DELETED)) {
+            return first + i;
+        }
+        i++;
+    }
+    return -1;
+}
+
+int pager_delete_employee(struct pager_t* pager, char* name) {
+    if (name == NULL) {
+        report_error("Got a NULL pointer\n");
+        return STATUS_ERROR;
+    }
+    struct name_query_t query;
+    name_query_init(&query, name);
+    unsigned int hash = strpool_hash(name, query.len);
+
+    // a name the filter never saw is not in the table, no page has to be read
+    if (!bloom_may_contain(pager->bloom, name, query.len)) {
+        report_error("Employee not found: %s\n", name);
+        return STATUS_ERROR;
+    }
+
+    int npages = (pager->header->count + RECORDS_PER_PAGE - 1) / RECORDS_PER_PAGE;
+    for (int page = 0; page < npages; page++) {
+        int index = find_in_page(pager, page, &query, hash);
+        if (index == -2) {
+            return STATUS_ERROR;
+        }
+        if (index == -1) {
+            continue;
+        }
+        // only the page holding the tombstone is brought in and becomes dirty
+        struct employee_t* e = pager_get(pager, index, true);
+        if (e == NULL) {
+            return STATUS_ERROR;
+        }
+        e->flags |= EMPLOYEE_DELETED;
+        pager->header->deleted++;
+        return STATUS_SUCCESS;
+    }
+    report_error("Employee not found: %s\n", name);
+    return STATUS_ERROR;
+}
+
+void pager_list_employees(struct pager_t* pager, int format) {
+    list_begin(format);
+    int printed = 0;
+    for (int i = 0; i < pager->header->count; i++) {
+        struct employee_t* e = pager_get(pager, i, false);
+        if (e == NULL) {
+            break;
+        }
+        if (e->flags & EMPLOYEE_DELETED) {
+            continue;
+        }
+        list_employee(e, pager->addresses, format, printed++);
+    }
+    list_end(format);
+}
@@ -1,83 +1,239 @@
 #include "parse.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
-#include "file.h"
 #include "common.h"
+#include "crc32c.h"
+#include "error.h"
+#include "file.h"
+#include "lz.h"
+#include "stats.h"
 
-void list_employees(struct db_header_t* header, struct employee_t* employees) {
-    printf("All employees: \n");
-    int i = 0;
-    for (; i < header->count; i++) {
-        struct employee_t* e = employees + i;
-        printf("Name:%s, Address:%s, Hours: %d\n", e->name, e->address, e->hours);
+static void print_escaped(const char* s, bool json) {
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '\\' || (json && c == '"')) {
+            printf("\\%c", c);
+        } else if (c == '\t') {
+            printf("\\t");
+        } else if (c == '\n') {
+            printf("\\n");
+        } else if (c < 0x20) {
+            printf(json ? "\\u%04x" : "\\x%02x", c);
+        } else {
+            putchar(c);
+        }
+    }
+}
+
+void list_begin(int format) {
+    if (format == LIST_FORMAT_TEXT) {
+        printf("All employees: \n");
+    } else if (format == LIST_FORMAT_JSON) {
+        printf("[");
+    } else if (format == LIST_FORMAT_TSV) {
+        printf("name\taddress\thours\n");
+    }
+}
+
+// nth is the number of records printed before this one
+void list_employee(const struct employee_t* e, struct dict_t* addresses, int format, int nth) {
+    const char* address = dict_string(addresses, e->address_id);
+    if (format == LIST_FORMAT_JSON) {
+        printf("%s\n{\"name\":\"", nth ? "," : "");
+        print_escaped(e->name, true);
+        printf("\",\"address\":\"");
+        print_escaped(address, true);
+        printf("\",\"hours\":%u}", e->hours);
+    } else if (format == LIST_FORMAT_TSV) {
+        print_escaped(e->name, false);
+        putchar('\t');
+        print_escaped(address, false);
+        printf("\t%u\n", e->hours);
+    } else if (format == LIST_FORMAT_BINARY) {
+        // the on-disk record, byte order and checksum included
+        struct employee_rec_t disk_employee;
+        encode_employee(e, &disk_employee);
+        fwrite(&disk_employee, sizeof(disk_employee), 1, stdout);
+    } else {
+        printf("Name:%s, Address:%s, Hours: %d\n", e->name, address, e->hours);
+    }
+}
+
+void list_end(int format) {
+    if (format == LIST_FORMAT_JSON) {
+        printf("\n]\n");
+    }
+    fflush(stdout);
+}
+
+// everything here comes from the header alone, no record is read
+void print_db_info(struct db_header_t* header, int format) {
+    bool compressed     = header->flags & DB_FLAG_COMPRESSED;
+    unsigned int blocks = compressed ? (header->count + COMPRESS_BLOCK_RECORDS - 1) / COMPRESS_BLOCK_RECORDS : 0;
+    unsigned int live   = header->count - header->deleted;
+    if (format == LIST_FORMAT_JSON) {
+        printf("{\"version\":%u,\"count\":%u,\"deleted\":%u,\"live\":%u,\"filesize\":%u,\"compressed\":%s,"
+               "\"blocks\":%u,\"data_offset\":%u,\"addresses\":%u,\"address_bytes\":%u,\"filter_bytes\":%u}\n",
+               header->version, header->count, header->deleted, live, header->filesize, compressed ? "true" : "false",
+               blocks, header->data_offset, header->dict_count, header->dict_bytes, header->bloom_bytes);
+    } else if (format == LIST_FORMAT_TSV) {
+        printf("version\tcount\tdeleted\tlive\tfilesize\tcompressed\tblocks\tdata_offset\taddresses\taddress_bytes\tfilter_bytes\n");
+        printf("%u\t%u\t%u\t%u\t%u\t%d\t%u\t%u\t%u\t%u\t%u\n", header->version, header->count, header->deleted, live,
+               header->filesize, compressed, blocks, header->data_offset, header->dict_count, header->dict_bytes,
+               header->bloom_bytes);
+    } else {
+        printf("Version: %u\n", header->version);
+        printf("Records: %u (%u live, %u deleted)\n", header->count, live, header->deleted);
+        printf("File size: %u bytes\n", header->filesize);
+        if (compressed) {
+            printf("Compressed: %u blocks of %d records\n", blocks, COMPRESS_BLOCK_RECORDS);
+        }
+        printf("Addresses: %u (%u bytes)\n", header->dict_count, header->dict_bytes);
+        printf("Name filter: %u bytes\n", header->bloom_bytes);
+        printf("Data offset: %u\n", header->data_offset);
     }
 }
 
 int create_db_header(int fd, struct db_header_t** headerOut) {
+    (void)fd;
     // struct db_header_t header = { 0 };
     struct db_header_t* header = calloc(1, sizeof(struct db_header_t));
     if (header == NULL) {
-        printf("Calloc failed\n");
+        report_error("Calloc failed\n");
         return STATUS_ERROR;
     }
-    header->version  = 0x1;
+    header->version  = DB_VERSION;
     header->count    = 0;
+    header->deleted  = 0;
+    header->flags    = 0;
     header->magic    = HEADER_MAGIC;
-    header->filesize = sizeof(struct db_header_t);
+    header->data_offset = sizeof(struct db_header_t) + DICT_MIN_RESERVE;
+    header->filesize    = header->data_offset;
+
+    *headerOut = header;
+    return STATUS_SUCCESS;
+}
+
+// the filesize v1 stored is not trusted, it was computed from the byte-swapped
+// count; the file only has to hold the records the count claims
+static int read_v1_header(int fd, struct db_header_t* header, struct db_header_t** headerOut) {
+    unsigned short count = ntohs(header->count);
+    memset(header, 0, sizeof(struct db_header_t));
+    header->magic       = HEADER_MAGIC;
+    header->version     = DB_VERSION_V1;
+    header->count       = count;
+    header->flags       = DB_FLAG_V1 | DB_FLAG_REWRITE;
+    header->data_offset = DB_V1_HEADER_SIZE;
+    header->filesize    = DB_V1_HEADER_SIZE + sizeof(struct employee_v1_rec_t) * count;
 
+    struct stat dbstat = { 0 };
+    fstat(fd, &dbstat);
+    if (header->filesize > dbstat.st_size) {
+        report_error("Invalid filesize: %u vs actual %lld\n", header->filesize, (long long)dbstat.st_size);
+        free(header);
+        return STATUS_ERROR;
+    }
     *headerOut = header;
     return STATUS_SUCCESS;
 }
 
 int retrieve_and_validate_db_header(int fd, struct db_header_t** headerOut) {
     if (fd < 0) {
-        printf("Got a bad FD from the user\n");
+        report_error("Got a bad FD from the user\n");
         return STATUS_ERROR;
     }
     struct db_header_t* header = calloc(1, sizeof(struct db_header_t));
     if (header == NULL) {
-        perror("Calloc failed\n");
+        report_error("Calloc failed\n");
         return STATUS_ERROR;
     }
     lseek(fd, 0, SEEK_SET);
     ssize_t bytes_read = read(fd, header, sizeof(struct db_header_t));
+    stats_syscall(SYSCALL_READ, bytes_read);
+
+    bool is_v1 = bytes_read >= DB_V1_HEADER_SIZE && ntohl(header->magic) == HEADER_MAGIC &&
+                 ntohs(header->version) == DB_VERSION_V1;
+    if (is_v1) {
+        return read_v1_header(fd, header, headerOut);
+    }
 
     bool valid_bytes_read = bytes_read == sizeof(struct db_header_t);
 
     if (!valid_bytes_read) {
-        perror("valid_bytes_read");
+        report_error("Short header: %zd of %zu bytes\n", bytes_read, sizeof(struct db_header_t));
         free(header);
         return STATUS_ERROR;
     }
 
+    // the checksum covers the header as stored, with its own field zeroed
+    unsigned int stored_checksum = ntohl(header->checksum);
+    header->checksum             = 0;
+    bool invalidChecksum         = crc32c(0, header, sizeof(struct db_header_t)) != stored_checksum;
+
     // network to host
     // change the decimal representation of the header fields to match the host's endianness
     header->version  = ntohs(header->version);
     header->count    = ntohs(header->count);
     header->magic    = ntohl(header->magic);
     header->filesize = ntohl(header->filesize);
+    header->deleted  = ntohs(header->deleted);
+    header->flags       = ntohs(header->flags);
+    header->data_offset = ntohl(header->data_offset);
+    header->dict_bytes  = ntohl(header->dict_bytes);
+    header->dict_count  = ntohl(header->dict_count);
+    header->dict_crc    = ntohl(header->dict_crc);
+    header->bloom_bytes = ntohl(header->bloom_bytes);
+    header->bloom_crc   = ntohl(header->bloom_crc);
 
-    bool invalidVersion = header->version != 0x1;
+    bool invalidVersion = header->version != DB_VERSION;
     bool invalidMagic   = header->magic != HEADER_MAGIC;
+    bool invalidDeleted = header->deleted > header->count;
+    // an uncompressed file holds its records at fixed offsets, all of them below filesize
+    bool invalidCount = !(header->flags & DB_FLAG_COMPRESSED) &&
+                        (unsigned long long)header->data_offset + sizeof(struct employee_rec_t) * header->count > header->filesize;
 
     struct stat dbstat = { 0 };
     fstat(fd, &dbstat);
 
-    bool invalidFilesize = header->filesize != dbstat.st_size;
+    // bytes past filesize are left over from an append that crashed before its
+    // header was written, the header is what commits records
+    bool invalidFilesize = header->filesize > dbstat.st_size;
+    bool invalidLayout   = header->data_offset < sizeof(struct db_header_t) || header->data_offset > header->filesize ||
+                         header->dict_bytes > header->data_offset - sizeof(struct db_header_t) ||
+                         header->bloom_bytes > header->data_offset - sizeof(struct db_header_t) - header->dict_bytes ||
+                         (header->bloom_bytes & (header->bloom_bytes - 1)) != 0;
 
-    if (invalidVersion || invalidMagic || invalidFilesize) {
+    if (invalidVersion || invalidMagic || invalidFilesize || invalidDeleted || invalidChecksum || invalidLayout ||
+        invalidCount) {
         if (invalidVersion) {
-            printf("Invalid version: %u\n", header->version);
+            report_error("Invalid version: %u\n", header->version);
         }
         if (invalidFilesize) {
-            printf("Invalid filesize: %u vs actual %lld\n", header->filesize, dbstat.st_size);
+            report_error("Invalid filesize: %u vs actual %lld\n", header->filesize, (long long)dbstat.st_size);
         }
         if (invalidMagic) {
-            printf("Invalid magic: 0x%x\n", header->magic);
+            report_error("Invalid magic: 0x%x\n", header->magic);
+        }
+        if (invalidDeleted) {
+            report_error("Invalid deleted count: %u of %u\n", header->deleted, header->count);
+        }
+        if (invalidChecksum) {
+            report_error("Invalid header checksum\n");
+        }
+        if (invalidCount) {
+            report_error("Invalid count: %u records do not fit in %u bytes\n", header->count, header->filesize);
+        }
+        if (invalidLayout) {
+            report_error("Invalid data offset: %u with a %u byte dictionary and a %u byte filter\n",
+                         header->data_offset, header->dict_bytes, header->bloom_bytes);
         }
         free(header);
         return STATUS_ERROR;
@@ -87,48 +243,710 @@ int retrieve_and_validate_db_header(int fd, struct db_header_t** headerOut) {
     return STATUS_SUCCESS;
 }
 
-int output_file(int fd, struct db_header_t* header, struct employee_t* employees) {
-    if (ftruncate(fd, 0) == -1) {
-        perror("ftruncate failed");
-        close(fd);
-        return -1;
+void encode_db_header(struct db_header_t* header, int count, struct db_header_t* out) {
+    out->magic    = htonl(header->magic);
+    out->version  = htons(header->version);
+    out->count    = htons(count);
+    // a compressed image is sized by its blocks, the caller sets filesize before encoding
+    if (header->flags & DB_FLAG_COMPRESSED) {
+        out->filesize = htonl(header->filesize);
+    } else {
+        out->filesize = htonl(header->data_offset + sizeof(struct employee_rec_t) * count);
     }
+    out->deleted     = htons(header->deleted);
+    out->flags       = htons(header->flags & ~(DB_FLAG_REWRITE | DB_FLAG_V1 | DB_FLAG_COMPACT));
+    out->data_offset = htonl(header->data_offset);
+    out->dict_bytes  = htonl(header->dict_bytes);
+    out->dict_count  = htonl(header->dict_count);
+    out->dict_crc    = htonl(header->dict_crc);
+    out->bloom_bytes = htonl(header->bloom_bytes);
+    out->bloom_crc   = htonl(header->bloom_crc);
+    out->checksum    = 0;
+    out->checksum = htonl(crc32c(0, out, sizeof(struct db_header_t)));
+}
+
+// records are checksummed in their on-disk byte order, up to the crc field
+static unsigned int record_checksum(const struct employee_rec_t* disk_employee) {
+    return crc32c(0, disk_employee, offsetof(struct employee_rec_t, crc));
+}
 
-    header->magic    = htonl(header->magic);
-    header->version  = htons(header->version);
-    header->count    = htons(header->count);
-    header->filesize = htonl(sizeof(struct db_header_t) + sizeof(struct employee_t) * header->count);
+static bool record_checksum_ok(const struct employee_rec_t* disk_employee) {
+    return record_checksum(disk_employee) == ntohl(disk_employee->crc);
+}
 
-    lseek(fd, 0, SEEK_SET);
-    int bytesWritten = write(fd, header, sizeof(struct db_header_t));
+void encode_employee(const struct employee_t* e, struct employee_rec_t* out) {
+    memset(out->name, 0, sizeof(out->name));
+    memcpy(out->name, e->name, e->name_len);
+    out->address_id = htonl(e->address_id);
+    out->hours      = htonl(e->hours);
+    out->flags      = htonl(e->flags & ~EMPLOYEE_DIRTY);
+    out->crc        = htonl(record_checksum(out));
+}
+
+// interns the name into names, out is only valid as long as the pool is
+int decode_employee(const struct employee_rec_t* rec, struct strpool_t* names, struct employee_t* out) {
+    if (!record_checksum_ok(rec)) {
+        return STATUS_ERROR;
+    }
+    out->name_len  = strnlen(rec->name, EMPLOYEE_NAME_MAX);
+    out->name_hash = strpool_hash(rec->name, out->name_len);
+    out->name      = strpool_intern(names, rec->name, out->name_len, out->name_hash);
+    if (out->name == NULL) {
+        return STATUS_ERROR;
+    }
+    out->address_id = ntohl(rec->address_id);
+    out->hours      = ntohl(rec->hours);
+    // the dirty bit never reaches the disk, a stored one would skip write-back
+    out->flags = ntohl(rec->flags) & ~EMPLOYEE_DIRTY;
+    return STATUS_SUCCESS;
+}
+
+bool employee_has_name(const struct employee_t* e, const char* name, unsigned int len, unsigned int hash) {
+    return e->name_hash == hash && e->name_len == len && memcmp(e->name, name, len) == 0;
+}
+
+// room for the dictionary to double before the records have to move
+static unsigned int dict_reserve(unsigned int used) {
+    unsigned int reserve = used * 2 > DICT_MIN_RESERVE ? used * 2 : DICT_MIN_RESERVE;
+    return (reserve + DICT_MIN_RESERVE - 1) / DICT_MIN_RESERVE * DICT_MIN_RESERVE;
+}
+
+bool dict_fits(struct db_header_t* header, struct dict_t* addresses) {
+    return addresses->used <= header->data_offset - header->bloom_bytes - sizeof(struct db_header_t);
+}
+
+void set_dict_header(struct db_header_t* header, struct dict_t* addresses) {
+    header->dict_bytes = addresses->used;
+    header->dict_count = addresses->count;
+    header->dict_crc   = crc32c(0, addresses->bytes, addresses->used);
+}
+
+int read_address_dict(int fd, struct db_header_t* header, struct dict_t** dictOut) {
+    char* bytes = malloc(header->dict_bytes > 0 ? header->dict_bytes : 1);
+    if (bytes == NULL) {
+        report_error("Malloc failed\n");
+        return STATUS_ERROR;
+    }
+    struct db_io_t io = { .buf = bytes, .len = header->dict_bytes, .offset = sizeof(struct db_header_t) };
+    if (header->dict_bytes > 0 && db_io_batch(fd, &io, 1, false) == STATUS_ERROR) {
+        free(bytes);
+        return STATUS_ERROR;
+    }
+    if (crc32c(0, bytes, header->dict_bytes) != header->dict_crc) {
+        report_error("Address dictionary checksum mismatch\n");
+        free(bytes);
+        return STATUS_ERROR;
+    }
+    int status = dict_load(bytes, header->dict_bytes, header->dict_count, dictOut);
+    free(bytes);
+    return status;
+}
+
+// a filter sized at another size than the header says, or for fewer names than
+// the table now holds, has to be rebuilt by a full rewrite; rewrites size it
+// for twice the count, so that happens each time the table doubles
+bool bloom_fits(struct db_header_t* header, struct bloom_t* bloom) {
+    return bloom->nbytes == header->bloom_bytes && bloom_size(header->count) <= bloom->nbytes;
+}
+
+void set_bloom_header(struct db_header_t* header, struct bloom_t* bloom) {
+    header->bloom_bytes = bloom->nbytes;
+    header->bloom_crc   = crc32c(0, bloom->bits, bloom->nbytes);
+}
+
+// a filter that is missing or fails its checksum comes back NULL, for the
+// caller to rebuild from the records
+int read_name_bloom(int fd, struct db_header_t* header, struct bloom_t** bloomOut) {
+    *bloomOut = NULL;
+    if (header->bloom_bytes == 0) {
+        return STATUS_SUCCESS;
+    }
+    unsigned char* bytes = malloc(header->bloom_bytes);
+    if (bytes == NULL) {
+        report_error("Malloc failed\n");
+        return STATUS_ERROR;
+    }
+    struct db_io_t io = { .buf = bytes, .len = header->bloom_bytes, .offset = header->data_offset - header->bloom_bytes };
+    if (db_io_batch(fd, &io, 1, false) == STATUS_ERROR) {
+        free(bytes);
+        return STATUS_ERROR;
+    }
+    if (crc32c(0, bytes, header->bloom_bytes) == header->bloom_crc) {
+        bloom_load(bytes, header->bloom_bytes, bloomOut);
+    }
+    free(bytes);
+    return STATUS_SUCCESS;
+}
+
+static void mark_bloom_dirty(struct bloom_t* bloom) {
+    for (unsigned int page = 0; page < bloom_pages(bloom); page++) {
+        bloom->dirty[page] = true;
+    }
+}
+
+int build_name_bloom(struct db_header_t* header, struct employee_t* employees, unsigned int nbytes, struct bloom_t** bloomOut) {
+    struct bloom_t* bloom = NULL;
+    if (bloom_create(nbytes, &bloom) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    for (int i = 0; i < header->count; i++) {
+        if (!(employees[i].flags & EMPLOYEE_DELETED)) {
+            bloom_add(bloom, employees[i].name, employees[i].name_len);
+        }
+    }
+    mark_bloom_dirty(bloom);
+    *bloomOut = bloom;
+    return STATUS_SUCCESS;
+}
+
+// the same from the raw records of an uncompressed file, for when they are not loaded
+int scan_name_bloom(int fd, struct db_header_t* header, unsigned int nbytes, struct bloom_t** bloomOut) {
+    struct bloom_t* bloom        = NULL;
+    struct employee_rec_t* chunk = calloc(COMPACT_CHUNK_RECORDS, sizeof(struct employee_rec_t));
+    if (chunk == NULL || bloom_create(nbytes, &bloom) == STATUS_ERROR) {
+        free(chunk);
+        return STATUS_ERROR;
+    }
+    for (int start = 0; start < header->count; start += COMPACT_CHUNK_RECORDS) {
+        int n = header->count - start;
+        n     = n < COMPACT_CHUNK_RECORDS ? n : COMPACT_CHUNK_RECORDS;
+        if (read_scan(fd, chunk, sizeof(struct employee_rec_t) * n, header->data_offset + sizeof(struct employee_rec_t) * start) == STATUS_ERROR) {
+            free(chunk);
+            bloom_free(bloom);
+            return STATUS_ERROR;
+        }
+        for (int i = 0; i < n; i++) {
+            if (!(ntohl(chunk[i].flags) & EMPLOYEE_DELETED)) {
+                bloom_add(bloom, chunk[i].name, strnlen(chunk[i].name, EMPLOYEE_NAME_MAX));
+            }
+        }
+    }
+    free(chunk);
+    mark_bloom_dirty(bloom);
+    *bloomOut = bloom;
+    return STATUS_SUCCESS;
+}
+
+// one write per changed page of the filter, which sits right before the records
+static int bloom_dirty_ios(struct db_header_t* header, struct bloom_t* bloom, struct db_io_t* ios) {
+    int n = 0;
+    for (unsigned int page = 0; page < bloom_pages(bloom); page++) {
+        if (!bloom->dirty[page]) {
+            continue;
+        }
+        size_t offset = (size_t)page * BLOOM_PAGE;
+        ios[n].buf    = bloom->bits + offset;
+        ios[n].len    = bloom->nbytes - offset < BLOOM_PAGE ? bloom->nbytes - offset : BLOOM_PAGE;
+        ios[n].offset = header->data_offset - header->bloom_bytes + offset;
+        n++;
+    }
+    return n;
+}
+
+// ios holds n writes of changed records and has room behind them for the new
+// end of the dictionary and the changed filter pages; all of that goes out and
+// is made durable, then the header that commits it. Without commit_header only
+// the records are written, for a rewrite that reads them back from the file.
+int commit_in_place(int fd, struct db_header_t* header, struct dict_t* addresses, struct bloom_t* bloom, struct db_io_t* ios, int n, bool commit_header) {
+    if (commit_header && addresses->used > header->dict_bytes) {
+        ios[n].buf    = addresses->bytes + header->dict_bytes;
+        ios[n].len    = addresses->used - header->dict_bytes;
+        ios[n].offset = sizeof(struct db_header_t) + header->dict_bytes;
+        n++;
+    }
+    if (commit_header) {
+        n += bloom_dirty_ios(header, bloom, ios + n);
+    }
+    // a rejected add or a delete that missed changed nothing, not even the header
+    if (n == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    if (lock_db_data(fd, true) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    int status = db_io_batch(fd, ios, n, true);
+
+    // records must be durable before the header that counts them
+    stats_syscall(SYSCALL_SYNC, 0);
+    if (status == STATUS_SUCCESS && fdatasync(fd) == -1) {
+        report_errno("fdatasync");
+        status = STATUS_ERROR;
+    }
+    if (status == STATUS_SUCCESS && commit_header) {
+        struct db_header_t disk_header;
+        set_dict_header(header, addresses);
+        set_bloom_header(header, bloom);
+        encode_db_header(header, header->count, &disk_header);
+        struct db_io_t io = { .buf = &disk_header, .len = sizeof(disk_header), .offset = 0 };
+        status            = db_io_batch(fd, &io, 1, true);
+
+        // bytes past the committed end are appends a rewrite took elsewhere
+        struct stat dbstat = { 0 };
+        if (status == STATUS_SUCCESS && fstat(fd, &dbstat) == 0 && dbstat.st_size > ntohl(disk_header.filesize)) {
+            ftruncate(fd, ntohl(disk_header.filesize));
+        }
+        stats_syscall(SYSCALL_SYNC, 0);
+        if (status == STATUS_SUCCESS && fdatasync(fd) == -1) {
+            report_errno("fdatasync");
+            status = STATUS_ERROR;
+        }
+        if (status == STATUS_SUCCESS) {
+            header->filesize = ntohl(disk_header.filesize);
+            bloom_clean(bloom);
+        }
+    }
+    unlock_db_data(fd);
+    return status;
+}
+
+static void clear_dirty(struct db_header_t* header, struct employee_t* employees) {
     for (int i = 0; i < header->count; i++) {
-        employees[i].hours = htonl(employees[i].hours);
-        bytesWritten += write(fd, &employees[i], sizeof(struct employee_t));
+        employees[i].flags &= ~EMPLOYEE_DIRTY;
+    }
+}
+
+// writes the dirty records in place, one batched write per contiguous run of
+// them, then the header; the header is the commit point for appended records
+static int write_dirty_records(int fd, struct db_header_t* header, struct employee_t* employees, struct dict_t* addresses, struct bloom_t* bloom) {
+    int count   = header->count;
+    int ndirty  = 0;
+    int nranges = 0;
+    for (int i = 0; i < count; i++) {
+        if (!(employees[i].flags & EMPLOYEE_DIRTY)) {
+            continue;
+        }
+        ndirty++;
+        if (i == 0 || !(employees[i - 1].flags & EMPLOYEE_DIRTY)) {
+            nranges++;
+        }
+        bloom_add(bloom, employees[i].name, employees[i].name_len);
+    }
+
+    struct employee_rec_t* disk_employees = malloc(sizeof(struct employee_rec_t) * (ndirty > 0 ? ndirty : 1));
+    // more slots for the strings appended to the dictionary and the changed filter pages
+    struct db_io_t* ios                   = calloc(nranges + 1 + bloom_pages(bloom), sizeof(struct db_io_t));
+    if (disk_employees == NULL || ios == NULL) {
+        report_error("Malloc failed\n");
+        free(disk_employees);
+        free(ios);
+        return STATUS_ERROR;
+    }
+
+    int used  = 0;
+    int range = -1;
+    for (int i = 0; i < count; i++) {
+        if (!(employees[i].flags & EMPLOYEE_DIRTY)) {
+            continue;
+        }
+        if (i == 0 || !(employees[i - 1].flags & EMPLOYEE_DIRTY)) {
+            range++;
+            ios[range].buf    = disk_employees + used;
+            ios[range].offset = header->data_offset + sizeof(struct employee_rec_t) * i;
+        }
+        encode_employee(&employees[i], &disk_employees[used++]);
+        ios[range].len += sizeof(struct employee_rec_t);
+    }
+
+    int status = commit_in_place(fd, header, addresses, bloom, ios, nranges, true);
+    free(disk_employees);
+    free(ios);
+    if (status == STATUS_SUCCESS) {
+        clear_dirty(header, employees);
+    }
+    return status;
+}
+
+int block_count(struct db_header_t* header) {
+    return (header->count + COMPRESS_BLOCK_RECORDS - 1) / COMPRESS_BLOCK_RECORDS;
+}
+
+int block_records(struct db_header_t* header, int block) {
+    int n = header->count - block * COMPRESS_BLOCK_RECORDS;
+    return n < COMPRESS_BLOCK_RECORDS ? n : COMPRESS_BLOCK_RECORDS;
+}
+
+// the entries and their checksum
+static size_t block_index_size(struct db_header_t* header) {
+    return sizeof(struct db_block_t) * block_count(header) + sizeof(unsigned int);
+}
+
+// block index, then the blocks; header and dictionary are left for the caller
+static int build_compressed_image(struct db_header_t* header, struct employee_t* employees, unsigned char** imageOut, size_t* sizeOut) {
+    int nblocks       = block_count(header);
+    size_t raw_block  = sizeof(struct employee_rec_t) * COMPRESS_BLOCK_RECORDS;
+    size_t index_size = block_index_size(header);
+    size_t capacity   = header->data_offset + index_size + lz_compress_bound(raw_block) * nblocks;
+
+    unsigned char* image                  = malloc(capacity);
+    struct employee_rec_t* disk_employees = malloc(raw_block);
+    if (image == NULL || disk_employees == NULL) {
+        report_error("Malloc failed\n");
+        free(image);
+        free(disk_employees);
+        return STATUS_ERROR;
+    }
+
+    // the dictionary ahead of the index has any length, so entries are copied
+    // in rather than written through a misaligned struct pointer
+    unsigned char* index = image + header->data_offset;
+    size_t pos           = header->data_offset + index_size;
+    for (int b = 0; b < nblocks; b++) {
+        int first = b * COMPRESS_BLOCK_RECORDS;
+        int n     = block_records(header, b);
+        for (int i = 0; i < n; i++) {
+            encode_employee(&employees[first + i], &disk_employees[i]);
+        }
+        size_t length   = lz_compress(disk_employees, sizeof(struct employee_rec_t) * n, image + pos, capacity - pos);
+        struct db_block_t entry = { 0 };
+        entry.offset            = htonl(pos);
+        entry.length            = htonl(length);
+        entry.crc               = htonl(crc32c(0, image + pos, length));
+        memcpy(index + sizeof(struct db_block_t) * b, &entry, sizeof(entry));
+        pos += length;
+    }
+    free(disk_employees);
+    unsigned int index_crc = htonl(crc32c(0, index, sizeof(struct db_block_t) * nblocks));
+    memcpy(index + sizeof(struct db_block_t) * nblocks, &index_crc, sizeof(index_crc));
+
+    *imageOut = image;
+    *sizeOut  = pos;
+    return STATUS_SUCCESS;
+}
+
+int read_block_index(int fd, struct db_header_t* header, struct db_block_t** indexOut) {
+    int nblocks       = block_count(header);
+    size_t index_size = block_index_size(header);
+    if (index_size > header->filesize - header->data_offset) {
+        report_error("Block index runs past the end of the file\n");
+        return STATUS_ERROR;
+    }
+    struct db_block_t* index = malloc(index_size);
+    if (index == NULL) {
+        report_error("Malloc failed\n");
+        return STATUS_ERROR;
+    }
+    struct db_io_t io = { .buf = index, .len = index_size, .offset = header->data_offset };
+    if (db_io_batch(fd, &io, 1, false) == STATUS_ERROR) {
+        free(index);
+        return STATUS_ERROR;
+    }
+    size_t entries_size = sizeof(struct db_block_t) * nblocks;
+    unsigned int stored = 0;
+    memcpy(&stored, (unsigned char*)index + entries_size, sizeof(stored));
+    if (crc32c(0, index, entries_size) != ntohl(stored)) {
+        report_error("Block index checksum mismatch\n");
+        free(index);
+        return STATUS_ERROR;
+    }
+
+    // every block has to lie between the index and the end of the file
+    size_t data_start = header->data_offset + index_size;
+    for (int b = 0; b < nblocks; b++) {
+        index[b].offset = ntohl(index[b].offset);
+        index[b].length = ntohl(index[b].length);
+        index[b].crc    = ntohl(index[b].crc);
+        if (index[b].offset < data_start || index[b].offset > header->filesize ||
+            index[b].length > header->filesize - index[b].offset) {
+            report_error("Invalid block index entry %d\n", b);
+            free(index);
+            return STATUS_ERROR;
+        }
+    }
+    *indexOut = index;
+    return STATUS_SUCCESS;
+}
+
+// records come out in their on-disk form, ready for decode_employee
+int decompress_block(struct db_header_t* header, const struct db_block_t* index, int block, const unsigned char* src, struct employee_rec_t* out) {
+    size_t expected = sizeof(struct employee_rec_t) * block_records(header, block);
+    size_t length   = 0;
+    if (crc32c(0, src, index[block].length) != index[block].crc ||
+        lz_decompress(src, index[block].length, out, expected, &length) == STATUS_ERROR || length != expected) {
+        report_error("Corrupt compressed block %d\n", block);
+        return STATUS_ERROR;
     }
-    printf("Wrote %d bytes to file\n", bytesWritten);
     return STATUS_SUCCESS;
 }
 
-int read_employees(int fd, struct db_header_t* header, struct employee_t** employeesOut) {
+// random access: reads and inflates a single block, out holds COMPRESS_BLOCK_RECORDS records
+int read_compressed_block(int fd, struct db_header_t* header, const struct db_block_t* index, int block, struct employee_rec_t* out) {
+    unsigned char* src = malloc(index[block].length > 0 ? index[block].length : 1);
+    if (src == NULL) {
+        report_error("Malloc failed\n");
+        return STATUS_ERROR;
+    }
+    struct db_io_t io = { .buf = src, .len = index[block].length, .offset = index[block].offset };
+    int status        = db_io_batch(fd, &io, 1, false);
+    if (status == STATUS_SUCCESS) {
+        status = decompress_block(header, index, block, src, out);
+    }
+    free(src);
+    return status;
+}
+
+static int read_employees_compressed(int fd, struct db_header_t* header, struct strpool_t* names, struct employee_t* employees, struct employee_t** employeesOut) {
+    struct db_block_t* index = NULL;
+    if (read_block_index(fd, header, &index) == STATUS_ERROR) {
+        free(employees);
+        return STATUS_ERROR;
+    }
+    struct employee_rec_t block[COMPRESS_BLOCK_RECORDS];
+
+    // the blocks are small and contiguous, one scan brings them all in
+    int nblocks        = block_count(header);
+    off_t start        = header->data_offset + block_index_size(header);
+    size_t length      = header->filesize - start;
+    unsigned char* src = malloc(length > 0 ? length : 1);
+    int status         = src == NULL ? STATUS_ERROR : STATUS_SUCCESS;
+    if (status == STATUS_SUCCESS && length > 0) {
+        status = read_scan(fd, src, length, start);
+    }
+    for (int b = 0; b < nblocks && status == STATUS_SUCCESS; b++) {
+        struct employee_t* out = employees + b * COMPRESS_BLOCK_RECORDS;
+        status                 = decompress_block(header, index, b, src + (index[b].offset - start), block);
+        for (int i = 0; status == STATUS_SUCCESS && i < block_records(header, b); i++) {
+            if (decode_employee(&block[i], names, &out[i]) != STATUS_SUCCESS) {
+                report_error("Checksum mismatch in record %d\n", b * COMPRESS_BLOCK_RECORDS + i);
+                status = STATUS_ERROR;
+            }
+        }
+    }
+    free(src);
+    free(index);
+
+    if (status == STATUS_ERROR) {
+        free(employees);
+        return STATUS_ERROR;
+    }
+    *employeesOut = employees;
+    return STATUS_SUCCESS;
+}
+
+int output_file(int fd, const char* path, struct db_header_t* header, struct employee_t* employees, struct dict_t* addresses, struct bloom_t* bloom) {
+    struct stat dbstat = { 0 };
+    if (fstat(fd, &dbstat) == -1) {
+        report_errno("fstat");
+        return STATUS_ERROR;
+    }
+
+    // past the threshold the dead slots are dropped while the image is built anyway,
+    // and a compressed image is always rebuilt whole
+    bool compressed = header->flags & DB_FLAG_COMPRESSED;
+    bool compacting = compressed || needs_compaction(header) || (header->flags & DB_FLAG_COMPACT);
+
+    // the file still holds exactly the image we loaded, so only the changes go out
+    bool in_place = !compacting && !(header->flags & DB_FLAG_REWRITE) && dict_fits(header, addresses) &&
+                    bloom_fits(header, bloom);
+    if (in_place && dbstat.st_size == header->filesize) {
+        return write_dirty_records(fd, header, employees, addresses, bloom);
+    }
+    int count       = 0;
+    for (int i = 0; i < header->count; i++) {
+        if (compacting && (employees[i].flags & EMPLOYEE_DELETED)) {
+            continue;
+        }
+        employees[count++] = employees[i];
+    }
+    if (compacting) {
+        header->deleted = 0;
+    }
+    header->count = count;
+
+    // the filter is rebuilt from the live records; a compressed image is never
+    // updated in place, so neither it nor the dictionary needs slack
+    struct bloom_t* fresh = NULL;
+    unsigned int nbytes   = bloom_size(compressed ? count : count * 2);
+    if (build_name_bloom(header, employees, nbytes, &fresh) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    header->version        = DB_VERSION;
+    unsigned int dict_room = compressed ? addresses->used : dict_reserve(addresses->used);
+    header->data_offset    = sizeof(struct db_header_t) + dict_room + nbytes;
+    size_t size          = 0;
+    unsigned char* image = NULL;
+    if (compressed) {
+        if (build_compressed_image(header, employees, &image, &size) == STATUS_ERROR) {
+            bloom_free(fresh);
+            return STATUS_ERROR;
+        }
+    } else {
+        size  = header->data_offset + sizeof(struct employee_rec_t) * count;
+        image = malloc(size);
+        if (image == NULL) {
+            report_error("Malloc failed\n");
+            bloom_free(fresh);
+            return STATUS_ERROR;
+        }
+        struct employee_rec_t* disk_employees = (struct employee_rec_t*)(image + header->data_offset);
+        for (int i = 0; i < count; i++) {
+            encode_employee(&employees[i], &disk_employees[i]);
+        }
+    }
+
+    memset(image + sizeof(struct db_header_t), 0, header->data_offset - sizeof(struct db_header_t));
+    // a new file's dictionary has no bytes allocated yet
+    if (addresses->used > 0) {
+        memcpy(image + sizeof(struct db_header_t), addresses->bytes, addresses->used);
+    }
+    memcpy(image + header->data_offset - nbytes, fresh->bits, nbytes);
+    set_dict_header(header, addresses);
+    set_bloom_header(header, fresh);
+    bloom_free(fresh);
+    header->filesize = size;
+    encode_db_header(header, count, (struct db_header_t*)image);
+
+    // readers keep the old inode until the rename, so they never see a partial image
+    char tmppath[4096];
+    int tmpfd = create_temp_db_file(path, tmppath, sizeof(tmppath));
+    if (tmpfd == STATUS_ERROR) {
+        free(image);
+        return STATUS_ERROR;
+    }
+    fchmod(tmpfd, dbstat.st_mode & 07777);
+
+    if (write_full(tmpfd, image, size) == STATUS_ERROR) {
+        free(image);
+        close(tmpfd);
+        unlink(tmppath);
+        return STATUS_ERROR;
+    }
+    free(image);
+
+    if (commit_temp_db_file(tmpfd, tmppath, path) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    header->flags &= ~(DB_FLAG_REWRITE | DB_FLAG_V1 | DB_FLAG_COMPACT);
+    clear_dirty(header, employees);
+    return STATUS_SUCCESS;
+}
+
+static int read_employees_direct(int fd, struct db_header_t* header, struct strpool_t* names, struct employee_t* employees, struct employee_t** employeesOut) {
+    int count                    = header->count;
+    int span                     = READ_CHUNK_RECORDS * READ_AHEAD_CHUNKS;
+    struct employee_rec_t* chunk = malloc(sizeof(struct employee_rec_t) * span);
+    int status                   = chunk == NULL ? STATUS_ERROR : STATUS_SUCCESS;
+    for (int start = 0; start < count && status == STATUS_SUCCESS; start += span) {
+        int n  = count - start < span ? count - start : span;
+        status = read_scan(fd, chunk, sizeof(struct employee_rec_t) * n, header->data_offset + sizeof(struct employee_rec_t) * start);
+        for (int i = 0; status == STATUS_SUCCESS && i < n; i++) {
+            if (decode_employee(&chunk[i], names, &employees[start + i]) != STATUS_SUCCESS) {
+                report_error("Checksum mismatch in record %d\n", start + i);
+                status = STATUS_ERROR;
+            }
+        }
+    }
+    free(chunk);
+    if (status == STATUS_ERROR) {
+        free(employees);
+        return STATUS_ERROR;
+    }
+    *employeesOut = employees;
+    return STATUS_SUCCESS;
+}
+
+// each address goes into the dictionary as the records are read
+static int read_employees_v1(int fd, struct db_header_t* header, struct strpool_t* names, struct dict_t* addresses, struct employee_t* employees, struct employee_t** employeesOut) {
+    struct employee_v1_rec_t* chunk = malloc(sizeof(struct employee_v1_rec_t) * COMPACT_CHUNK_RECORDS);
+    int status                      = chunk == NULL ? STATUS_ERROR : STATUS_SUCCESS;
+    for (int start = 0; start < header->count && status == STATUS_SUCCESS; start += COMPACT_CHUNK_RECORDS) {
+        int n  = header->count - start < COMPACT_CHUNK_RECORDS ? header->count - start : COMPACT_CHUNK_RECORDS;
+        status = read_scan(fd, chunk, sizeof(struct employee_v1_rec_t) * n, header->data_offset + sizeof(struct employee_v1_rec_t) * start);
+        for (int i = 0; status == STATUS_SUCCESS && i < n; i++) {
+            status = build_employee(chunk[i].name, chunk[i].address, ntohl(chunk[i].hours), names, addresses, &employees[start + i]);
+        }
+    }
+    free(chunk);
+    if (status == STATUS_ERROR) {
+        free(employees);
+        return STATUS_ERROR;
+    }
+    *employeesOut = employees;
+    return STATUS_SUCCESS;
+}
+
+int read_employees(int fd, struct db_header_t* header, struct strpool_t* names, struct dict_t* addresses, struct employee_t** employeesOut) {
 
     if (fd < 0) {
-        printf("Got a bad FD from the user\n");
+        report_error("Got a bad FD from the user\n");
         return STATUS_ERROR;
     }
-    lseek(fd, sizeof(struct db_header_t), SEEK_SET);
     int count = header->count;
 
-    struct employee_t* employees = calloc(count, sizeof(struct employee_t));
+    // an empty table still gets an array, add_employee grows it with realloc
+    struct employee_t* employees = calloc(count > 0 ? count : 1, sizeof(struct employee_t));
 
     if (employees == NULL) {
-        printf("Malloc Failed");
+        report_error("Malloc failed\n");
         return STATUS_ERROR;
     }
 
-    read(fd, employees, count * sizeof(struct employee_t));
+    if (header->flags & DB_FLAG_COMPRESSED) {
+        return read_employees_compressed(fd, header, names, employees, employeesOut);
+    }
+    if (header->flags & DB_FLAG_V1) {
+        return read_employees_v1(fd, header, names, addresses, employees, employeesOut);
+    }
+    if (db_io_is_direct()) {
+        return read_employees_direct(fd, header, names, employees, employeesOut);
+    }
+    posix_fadvise(fd, header->data_offset, sizeof(struct employee_rec_t) * count, POSIX_FADV_SEQUENTIAL);
 
-    for (int i = 0; i < count; i++) {
-        employees[i].hours = ntohl(employees[i].hours);
+    // two windows of chunk buffers: one being decoded, the other in flight
+    int nchunks                    = (count + READ_CHUNK_RECORDS - 1) / READ_CHUNK_RECORDS;
+    struct db_io_t* ios            = calloc(nchunks > 0 ? nchunks : 1, sizeof(struct db_io_t));
+    struct employee_rec_t* buffers = malloc(sizeof(struct employee_rec_t) * READ_CHUNK_RECORDS * READ_AHEAD_CHUNKS * 2);
+    if (ios == NULL || buffers == NULL) {
+        report_error("Calloc failed\n");
+        free(ios);
+        free(buffers);
+        free(employees);
+        return STATUS_ERROR;
+    }
+    for (int c = 0; c < nchunks; c++) {
+        int first     = c * READ_CHUNK_RECORDS;
+        int n         = count - first < READ_CHUNK_RECORDS ? count - first : READ_CHUNK_RECORDS;
+        ios[c].buf    = buffers + (c % (READ_AHEAD_CHUNKS * 2)) * READ_CHUNK_RECORDS;
+        ios[c].len    = sizeof(struct employee_rec_t) * n;
+        ios[c].offset = header->data_offset + sizeof(struct employee_rec_t) * first;
+    }
+
+    // the next window of chunks is in flight while the current one is decoded
+    int status = STATUS_SUCCESS;
+    if (nchunks > 0) {
+        status = db_io_submit(fd, ios, nchunks < READ_AHEAD_CHUNKS ? nchunks : READ_AHEAD_CHUNKS, false);
+    }
+    for (int start = 0; start < nchunks && status == STATUS_SUCCESS; start += READ_AHEAD_CHUNKS) {
+        int n    = nchunks - start < READ_AHEAD_CHUNKS ? nchunks - start : READ_AHEAD_CHUNKS;
+        int next = start + READ_AHEAD_CHUNKS;
+        if (next < nchunks) {
+            int ahead = nchunks - next < READ_AHEAD_CHUNKS ? nchunks - next : READ_AHEAD_CHUNKS;
+            status    = db_io_submit(fd, ios + next, ahead, false);
+        }
+        if (db_io_wait(fd, ios + start, n) == STATUS_ERROR) {
+            status = STATUS_ERROR;
+        }
+        if (status == STATUS_ERROR) {
+            break;
+        }
+
+        int last = (start + n) * READ_CHUNK_RECORDS;
+        last     = last < count ? last : count;
+        for (int i = start * READ_CHUNK_RECORDS; i < last; i++) {
+            const struct employee_rec_t* rec = buffers + (i % (READ_CHUNK_RECORDS * READ_AHEAD_CHUNKS * 2));
+            if (decode_employee(rec, names, &employees[i]) != STATUS_SUCCESS) {
+                report_error("Checksum mismatch in record %d\n", i);
+                status = STATUS_ERROR;
+                break;
+            }
+        }
+    }
+    free(ios);
+    free(buffers);
+
+    if (status == STATUS_ERROR) {
+        free(employees);
+        return STATUS_ERROR;
     }
 
     *employeesOut = employees;
@@ -136,89 +954,330 @@ int read_employees(int fd, struct db_header_t* header, struct employee_t** emplo
     return STATUS_SUCCESS;
 }
 
-int add_employee(struct db_header_t* header, struct employee_t** employees, char* addstring) {
-    if (header == NULL || employees == NULL || *employees == NULL || addstring == NULL) {
-        perror("Null Pointer");
+// names and addresses longer than a record holds are cut to EMPLOYEE_NAME_MAX
+int build_employee(const char* name, const char* addr, unsigned int hours, struct strpool_t* names, struct dict_t* addresses, struct employee_t* out) {
+    memset(out, 0, sizeof(struct employee_t));
+    out->name_len  = strnlen(name, EMPLOYEE_NAME_MAX);
+    out->name_hash = strpool_hash(name, out->name_len);
+    out->name      = strpool_intern(names, name, out->name_len, out->name_hash);
+    if (out->name == NULL) {
         return STATUS_ERROR;
     }
+    char address[EMPLOYEE_NAME_MAX + 1] = { 0 };
+    strncpy(address, addr, sizeof(address) - 1);
+    if (dict_intern(addresses, address, &out->address_id) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    out->hours = hours;
 
-    char* name = strtok(addstring, ",");
-    if (name == NULL) {
+    return STATUS_SUCCESS;
+}
+
+int parse_employee(char* addstring, struct strpool_t* names, struct dict_t* addresses, struct employee_t* out) {
+    char* name  = strtok(addstring, ",");
+    char* addr  = name ? strtok(NULL, ",") : NULL;
+    char* hours = addr ? strtok(NULL, ",") : NULL;
+    if (hours == NULL || strtok(NULL, ",") != NULL) {
+        report_error("Expected name,address,hours\n");
         return STATUS_ERROR;
     }
-    char* addr  = strtok(NULL, ",");
-    char* hours = strtok(NULL, ",");
-    printf("Trying to add the following information into the datbase:\n");
-    printf("Name: %s\nAddress: %s\nHours: %s\n", name, addr, hours);
+    // atoi would take "abc" as 0 and "-1" as 4294967295 hours
+    char* end           = NULL;
+    unsigned long value = strtoul(hours, &end, 10);
+    if (end == hours || *end != '\0' || hours[0] == '-' || value > UINT_MAX) {
+        report_error("Invalid hours: %s\n", hours);
+        return STATUS_ERROR;
+    }
+    return build_employee(name, addr, value, names, addresses, out);
+}
 
-    struct employee_t* e = realloc(*employees, sizeof(struct employee_t) * (header->count + 1));
-    if (e == NULL) {
+// e's name must already live in the pool the table's names come from
+int append_employee(struct db_header_t* header, struct employee_t** employees, const struct employee_t* e) {
+    // the header counts records in 16 bits
+    if (header->count == USHRT_MAX) {
+        report_error("Database is full at %u records\n", header->count);
+        return STATUS_ERROR;
+    }
+
+    struct employee_t* grown = realloc(*employees, sizeof(struct employee_t) * (header->count + 1));
+    if (grown == NULL) {
         return STATUS_ERROR;
     }
     header->count++;
-    int lastindex = header->count - 1;
-    strncpy(e[lastindex].name, name, sizeof(e[lastindex].name) - 1);
-    strncpy(e[lastindex].address, addr, sizeof(e[lastindex].address) - 1);
-    e[lastindex].hours = atoi(hours);
+    int lastindex          = header->count - 1;
+    grown[lastindex]       = *e;
+    grown[lastindex].flags = EMPLOYEE_DIRTY;
 
-    *employees = e;
+    *employees = grown;
 
     return STATUS_SUCCESS;
 }
 
-int delete_employee(struct db_header_t* header, struct employee_t** employees, char* name) {
-    int delete_index          = 0;
-    bool deletion_takes_place = false;
+int add_employee(struct db_header_t* header, struct employee_t** employees, struct strpool_t* names, struct dict_t* addresses, char* addstring) {
+    if (header == NULL || employees == NULL || *employees == NULL || addresses == NULL || addstring == NULL) {
+        report_error("Got a NULL pointer\n");
+        return STATUS_ERROR;
+    }
+    if (header->count == USHRT_MAX) {
+        report_error("Database is full at %u records\n", header->count);
+        return STATUS_ERROR;
+    }
 
-    for (; delete_index < header->count; delete_index++) {
-        struct employee_t* e = *employees + delete_index;
-        if ((char*)e->name == NULL) {
-            perror("e->name == NULL");
-            return STATUS_ERROR;
+    struct employee_t parsed;
+    if (parse_employee(addstring, names, addresses, &parsed) != STATUS_SUCCESS) {
+        return STATUS_ERROR;
+    }
+    return append_employee(header, employees, &parsed);
+}
+
+// index of the first live record with this name, -1 when there is none
+int find_employee(struct db_header_t* header, struct employee_t* employees, const char* name) {
+    unsigned int len  = strlen(name);
+    unsigned int hash = strpool_hash(name, len);
+    for (int i = 0; i < header->count; i++) {
+        struct employee_t* e = employees + i;
+        if (!(e->flags & EMPLOYEE_DELETED) && employee_has_name(e, name, len, hash)) {
+            return i;
         }
-        if (name == NULL) {
-            perror("name == NULL");
-            return STATUS_ERROR;
+    }
+    return -1;
+}
+
+int delete_employee(struct db_header_t* header, struct employee_t** employees, const char* name) {
+    if (header == NULL || employees == NULL || name == NULL) {
+        report_error("Got a NULL pointer\n");
+        return STATUS_ERROR;
+    }
+
+    int delete_index = find_employee(header, *employees, name);
+    if (delete_index == -1) {
+        report_error("Employee not found: %s\n", name);
+        return STATUS_ERROR;
+    }
+
+    // tombstone the slot in place, the live records get packed by compact_db_file
+    (*employees)[delete_index].flags |= EMPLOYEE_DELETED | EMPLOYEE_DIRTY;
+    header->deleted++;
+
+    return STATUS_SUCCESS;
+}
+
+bool needs_compaction(struct db_header_t* header) {
+    return header->deleted > 0 && header->deleted * 100 > header->count * COMPACT_THRESHOLD_PERCENT;
+}
+
+// an intact record whose address id the dictionary does not hold is corrupt all the same
+static bool record_ok(const struct employee_rec_t* disk_employee, struct dict_t* addresses) {
+    return record_checksum_ok(disk_employee) && ntohl(disk_employee->address_id) < addresses->count;
+}
+
+int compact_db_file(int fd, const char* path, struct db_header_t* header, struct dict_t* addresses) {
+    if (fd < 0) {
+        report_error("Got a bad FD from the user\n");
+        return STATUS_ERROR;
+    }
+
+    char tmppath[4096];
+    int tmpfd = create_temp_db_file(path, tmppath, sizeof(tmppath));
+    if (tmpfd == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+
+    // records stay in network order, only checked and the flags word looked at
+    struct employee_rec_t* chunk = calloc(COMPACT_CHUNK_RECORDS, sizeof(struct employee_rec_t));
+    if (chunk == NULL) {
+        report_error("Calloc failed\n");
+        close(tmpfd);
+        unlink(tmppath);
+        return STATUS_ERROR;
+    }
+
+    // the dictionary comes along as a whole, with fresh room to grow, and the
+    // filter is rebuilt from the records that are kept
+    struct bloom_t* bloom    = NULL;
+    unsigned int bloom_bytes = bloom_size((header->count - header->deleted) * 2);
+    if (bloom_create(bloom_bytes, &bloom) == STATUS_ERROR) {
+        goto fail;
+    }
+    off_t data_offset = sizeof(struct db_header_t) + dict_reserve(addresses->used) + bloom_bytes;
+    stats_syscall(SYSCALL_WRITE, addresses->used);
+    if (pwrite(tmpfd, addresses->bytes, addresses->used, sizeof(struct db_header_t)) != (ssize_t)addresses->used) {
+        report_errno("pwrite");
+        goto fail;
+    }
+
+    int live      = 0;
+    off_t in_pos  = header->data_offset;
+    off_t out_pos = data_offset;
+    for (int start = 0; start < header->count; start += COMPACT_CHUNK_RECORDS) {
+        int n         = header->count - start;
+        n             = n < COMPACT_CHUNK_RECORDS ? n : COMPACT_CHUNK_RECORDS;
+        size_t nbytes = sizeof(struct employee_rec_t) * n;
+        if (read_scan(fd, chunk, nbytes, in_pos) == STATUS_ERROR) {
+            goto fail;
         }
-        bool name_matched = strcmp(e->name, name) == 0;
-        if (name_matched) {
-            deletion_takes_place = true;
-            break;
+        in_pos += nbytes;
+
+        int kept = 0;
+        for (int i = 0; i < n; i++) {
+            // copying a corrupt record would sign it valid in the new image
+            if (!record_ok(&chunk[i], addresses)) {
+                report_error("Corrupt record %d, the file is left as it was\n", start + i);
+                goto fail;
+            }
+            if (ntohl(chunk[i].flags) & EMPLOYEE_DELETED) {
+                continue;
+            }
+            if (kept != i) {
+                chunk[kept] = chunk[i];
+            }
+            bloom_add(bloom, chunk[kept].name, strnlen(chunk[kept].name, EMPLOYEE_NAME_MAX));
+            kept++;
         }
+
+        nbytes = sizeof(struct employee_rec_t) * kept;
+        stats_syscall(SYSCALL_WRITE, nbytes);
+        if (pwrite(tmpfd, chunk, nbytes, out_pos) != (ssize_t)nbytes) {
+            report_errno("pwrite");
+            goto fail;
+        }
+        out_pos += nbytes;
+        live += kept;
     }
 
-    printf("Deleting User: %s\n", (*employees)[delete_index].name);
+    stats_syscall(SYSCALL_WRITE, bloom_bytes);
+    if (pwrite(tmpfd, bloom->bits, bloom_bytes, data_offset - bloom_bytes) != (ssize_t)bloom_bytes) {
+        report_errno("pwrite");
+        goto fail;
+    }
 
-    if (deletion_takes_place) {
-        int old_count = header->count;
-        int new_count = header->count - 1;
+    struct db_header_t compacted = *header;
+    compacted.version            = DB_VERSION;
+    compacted.deleted            = 0;
+    compacted.data_offset        = data_offset;
+    set_dict_header(&compacted, addresses);
+    set_bloom_header(&compacted, bloom);
+    struct db_header_t disk_header;
+    encode_db_header(&compacted, live, &disk_header);
+    stats_syscall(SYSCALL_WRITE, sizeof(disk_header));
+    if (pwrite(tmpfd, &disk_header, sizeof(disk_header), 0) != sizeof(disk_header)) {
+        report_errno("pwrite");
+        goto fail;
+    }
+    free(chunk);
+    bloom_free(bloom);
+    drop_scan_cache(fd, 0, 0);
 
-        struct employee_t* new_employees = calloc(new_count, sizeof(struct employee_t));
+    if (commit_temp_db_file(tmpfd, tmppath, path) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
 
-        int i            = 0;
-        int new_e_cursor = 0;
-        for (; i < old_count; i++) {
-            if (i != delete_index) {
-                struct employee_t* remained_employee = *employees + i;
-                struct employee_t* new_employee      = new_employees + new_e_cursor;
+    *header          = compacted;
+    header->count    = live;
+    header->filesize = ntohl(disk_header.filesize);
+    return STATUS_SUCCESS;
 
-                strncpy(
-                    new_employee->name,
-                    remained_employee->name,
-                    sizeof(remained_employee->name) - 1);
+fail:
+    free(chunk);
+    bloom_free(bloom);
+    close(tmpfd);
+    unlink(tmppath);
+    return STATUS_ERROR;
+}
 
-                strncpy(
-                    new_employee->address,
-                    remained_employee->address,
-                    sizeof(remained_employee->address) - 1);
+// a block that fails its own checksum counts all of its records as corrupt
+static int verify_compressed_db_file(int fd, struct db_header_t* header, struct dict_t* addresses, int* badOut) {
+    struct db_block_t* index = NULL;
+    if (read_block_index(fd, header, &index) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    struct employee_rec_t* block = calloc(COMPRESS_BLOCK_RECORDS, sizeof(struct employee_rec_t));
+    if (block == NULL) {
+        report_error("Calloc failed\n");
+        free(index);
+        return STATUS_ERROR;
+    }
 
-                new_employee->hours = remained_employee->hours;
+    int bad = 0;
+    for (int b = 0; b < block_count(header); b++) {
+        int n = block_records(header, b);
+        if (read_compressed_block(fd, header, index, b, block) == STATUS_ERROR) {
+            bad += n;
+            continue;
+        }
+        for (int i = 0; i < n; i++) {
+            if (!record_ok(&block[i], addresses)) {
+                report_error("Checksum mismatch in record %d\n", b * COMPRESS_BLOCK_RECORDS + i);
+                bad++;
+            }
+        }
+    }
+    free(block);
+    free(index);
+    *badOut = bad;
+    return STATUS_SUCCESS;
+}
+
+static int verify_records(int fd, struct db_header_t* header, struct dict_t* addresses, int* badOut) {
+    if (header->flags & DB_FLAG_COMPRESSED) {
+        return verify_compressed_db_file(fd, header, addresses, badOut);
+    }
 
-                new_e_cursor++;
+    struct employee_rec_t* chunk = calloc(COMPACT_CHUNK_RECORDS, sizeof(struct employee_rec_t));
+    if (chunk == NULL) {
+        report_error("Calloc failed\n");
+        return STATUS_ERROR;
+    }
+
+    int bad      = 0;
+    off_t in_pos = header->data_offset;
+    for (int start = 0; start < header->count; start += COMPACT_CHUNK_RECORDS) {
+        int n         = header->count - start;
+        n             = n < COMPACT_CHUNK_RECORDS ? n : COMPACT_CHUNK_RECORDS;
+        size_t nbytes = sizeof(struct employee_rec_t) * n;
+        if (read_scan(fd, chunk, nbytes, in_pos) == STATUS_ERROR) {
+            free(chunk);
+            return STATUS_ERROR;
+        }
+        in_pos += nbytes;
+
+        for (int i = 0; i < n; i++) {
+            if (!record_ok(&chunk[i], addresses)) {
+                report_error("Checksum mismatch in record %d\n", start + i);
+                bad++;
             }
         }
+    }
+    free(chunk);
+    // a full scan should not leave the whole file behind in the shared page cache
+    drop_scan_cache(fd, 0, 0);
+    *badOut = bad;
+    return STATUS_SUCCESS;
+}
 
-        header->count--;
-        *employees = new_employees;
+// STATUS_ERROR only when the file could not be read; what was found corrupt
+// is in the result, for the caller to report
+int verify_db_file(int fd, struct db_header_t* header, struct verify_result_t* resultOut) {
+    if (fd < 0) {
+        report_error("Got a bad FD from the user\n");
+        return STATUS_ERROR;
+    }
+    struct verify_result_t result = { 0 };
+    struct dict_t* addresses      = NULL;
+    result.dict_ok                = read_address_dict(fd, header, &addresses) == STATUS_SUCCESS;
+    if (result.dict_ok) {
+        result.records = header->count;
+        int status     = verify_records(fd, header, addresses, &result.corrupt);
+        dict_free(addresses);
+        if (status == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
     }
-}
\ No newline at end of file
+
+    // a stale filter costs lookups their short cut, it loses no records
+    struct bloom_t* bloom = NULL;
+    result.bloom_ok       = read_name_bloom(fd, header, &bloom) == STATUS_SUCCESS && bloom != NULL;
+    bloom_free(bloom);
+    *resultOut = result;
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,400 @@
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "common.h"
+#include "error.h"
+#include "file.h"
+#include "sort.h"
+#include "stats.h"
+
+// one run buffer of the merge, the records of run [next - filled + head, next) are in buf
+struct merge_run_t {
+    struct employee_rec_t* buf;
+    int head;
+    int filled;
+    int next;
+    int length;
+};
+
+// qsort takes no context, the run being sorted is reached through this
+static struct sorter_t* sorting;
+
+int sort_field_parse(const char* name, int* fieldOut) {
+    if (strcmp(name, "name") == 0) {
+        *fieldOut = SORT_BY_NAME;
+    } else if (strcmp(name, "address") == 0) {
+        *fieldOut = SORT_BY_ADDRESS;
+    } else if (strcmp(name, "hours") == 0) {
+        *fieldOut = SORT_BY_HOURS;
+    } else {
+        report_error("Unknown sort field: %s, expected name, address or hours\n", name);
+        return STATUS_ERROR;
+    }
+    return STATUS_SUCCESS;
+}
+
+int sorter_create(int field, struct dict_t* addresses, struct sorter_t** sorterOut) {
+    struct sorter_t* sorter = calloc(1, sizeof(struct sorter_t));
+    if (sorter == NULL) {
+        report_error("Calloc failed\n");
+        return STATUS_ERROR;
+    }
+    sorter->field     = field;
+    sorter->addresses = addresses;
+    sorter->run       = malloc(sizeof(struct employee_rec_t) * SORT_RUN_RECORDS);
+    sorter->order     = malloc(sizeof(unsigned int) * SORT_RUN_RECORDS);
+    sorter->scratch   = malloc(sizeof(unsigned int) * SORT_RUN_RECORDS);
+    if (sorter->run == NULL || sorter->order == NULL || sorter->scratch == NULL) {
+        report_error("Malloc failed\n");
+        sorter_free(sorter);
+        return STATUS_ERROR;
+    }
+    *sorterOut = sorter;
+    return STATUS_SUCCESS;
+}
+
+static int compare_records(struct sorter_t* sorter, const struct employee_rec_t* a, const struct employee_rec_t* b) {
+    if (sorter->field == SORT_BY_HOURS) {
+        unsigned int x = ntohl(a->hours);
+        unsigned int y = ntohl(b->hours);
+        return (x > y) - (x < y);
+    }
+    if (sorter->field == SORT_BY_ADDRESS) {
+        return strcmp(dict_string(sorter->addresses, ntohl(a->address_id)), dict_string(sorter->addresses, ntohl(b->address_id)));
+    }
+    return strncmp(a->name, b->name, sizeof(a->name));
+}
+
+static int compare_order(const void* x, const void* y) {
+    unsigned int i = *(const unsigned int*)x;
+    unsigned int j = *(const unsigned int*)y;
+    int c          = compare_records(sorting, &sorting->run[i], &sorting->run[j]);
+    return c ? c : (i > j) - (i < j);
+}
+
+// LSD over the four bytes of the key, each pass stable, so ties keep table order;
+// an even number of passes leaves the result in order
+static void radix_sort_hours(struct sorter_t* sorter) {
+    unsigned int* from = sorter->order;
+    unsigned int* to   = sorter->scratch;
+    for (int shift = 0; shift < 32; shift += 8) {
+        unsigned int counts[257] = { 0 };
+        for (int i = 0; i < sorter->used; i++) {
+            counts[((ntohl(sorter->run[from[i]].hours) >> shift) & 0xff) + 1]++;
+        }
+        for (int b = 0; b < 256; b++) {
+            counts[b + 1] += counts[b];
+        }
+        for (int i = 0; i < sorter->used; i++) {
+            to[counts[(ntohl(sorter->run[from[i]].hours) >> shift) & 0xff]++] = from[i];
+        }
+        unsigned int* swap = from;
+        from               = to;
+        to                 = swap;
+    }
+}
+
+static void sort_run(struct sorter_t* sorter) {
+    for (int i = 0; i < sorter->used; i++) {
+        sorter->order[i] = i;
+    }
+    if (sorter->field == SORT_BY_HOURS) {
+        radix_sort_hours(sorter);
+    } else {
+        sorting = sorter;
+        qsort(sorter->order, sorter->used, sizeof(unsigned int), compare_order);
+    }
+}
+
+static int spill_run(struct sorter_t* sorter) {
+    if (sorter->spill == NULL) {
+        sorter->spill = tmpfile();
+        if (sorter->spill == NULL) {
+            report_errno("tmpfile");
+            return STATUS_ERROR;
+        }
+    }
+    sort_run(sorter);
+    struct employee_rec_t chunk[SORT_MERGE_RECORDS];
+    for (int i = 0; i < sorter->used; i += SORT_MERGE_RECORDS) {
+        int n = sorter->used - i < SORT_MERGE_RECORDS ? sorter->used - i : SORT_MERGE_RECORDS;
+        for (int k = 0; k < n; k++) {
+            chunk[k] = sorter->run[sorter->order[i + k]];
+        }
+        if (write_full(fileno(sorter->spill), chunk, sizeof(struct employee_rec_t) * n) == STATUS_ERROR) {
+            return STATUS_ERROR;
+        }
+    }
+    sorter->nruns++;
+    sorter->spilled += sorter->used;
+    sorter->used = 0;
+    return STATUS_SUCCESS;
+}
+
+int sorter_add(struct sorter_t* sorter, const struct employee_t* e) {
+    if (sorter->used == SORT_RUN_RECORDS && spill_run(sorter) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    encode_employee(e, &sorter->run[sorter->used++]);
+    return STATUS_SUCCESS;
+}
+
+// the names of what was printed are dropped every SORT_MERGE_RECORDS records
+static int emit(struct sorter_t* sorter, struct strpool_t* names, const struct employee_rec_t* rec, int format, int* printed) {
+    if (*printed % SORT_MERGE_RECORDS == 0) {
+        strpool_reset(names);
+    }
+    struct employee_t e;
+    if (decode_employee(rec, names, &e) != STATUS_SUCCESS) {
+        report_error("Checksum mismatch in a sorted record\n");
+        return STATUS_ERROR;
+    }
+    list_employee(&e, sorter->addresses, format, (*printed)++);
+    return STATUS_SUCCESS;
+}
+
+static int refill(struct sorter_t* sorter, struct merge_run_t* run, int r) {
+    int n          = run->length - run->next < SORT_MERGE_RECORDS ? run->length - run->next : SORT_MERGE_RECORDS;
+    size_t nbytes  = sizeof(struct employee_rec_t) * n;
+    off_t offset   = sizeof(struct employee_rec_t) * ((off_t)r * SORT_RUN_RECORDS + run->next);
+    ssize_t result = pread(fileno(sorter->spill), run->buf, nbytes, offset);
+    stats_syscall(SYSCALL_READ, result);
+    if (result != (ssize_t)nbytes) {
+        report_errno("pread");
+        return STATUS_ERROR;
+    }
+    run->head   = 0;
+    run->filled = n;
+    run->next += n;
+    return STATUS_SUCCESS;
+}
+
+// ties go to the earlier run, which holds the earlier records of the table
+static bool merge_less(struct sorter_t* sorter, struct merge_run_t* runs, int a, int b) {
+    int c = compare_records(sorter, &runs[a].buf[runs[a].head], &runs[b].buf[runs[b].head]);
+    return c < 0 || (c == 0 && a < b);
+}
+
+static void sift_down(struct sorter_t* sorter, struct merge_run_t* runs, int* heap, int n, int i) {
+    for (;;) {
+        int least = i;
+        int left  = 2 * i + 1;
+        int right = left + 1;
+        if (left < n && merge_less(sorter, runs, heap[left], heap[least])) {
+            least = left;
+        }
+        if (right < n && merge_less(sorter, runs, heap[right], heap[least])) {
+            least = right;
+        }
+        if (least == i) {
+            return;
+        }
+        int swap    = heap[i];
+        heap[i]     = heap[least];
+        heap[least] = swap;
+        i           = least;
+    }
+}
+
+static int merge_runs(struct sorter_t* sorter, struct strpool_t* names, int format, int* printed) {
+    struct merge_run_t* runs = calloc(sorter->nruns, sizeof(struct merge_run_t));
+    int* heap                = calloc(sorter->nruns, sizeof(int));
+    int status               = runs == NULL || heap == NULL ? STATUS_ERROR : STATUS_SUCCESS;
+    int n                    = 0;
+    for (int r = 0; status == STATUS_SUCCESS && r < sorter->nruns; r++) {
+        int remaining  = sorter->spilled - r * SORT_RUN_RECORDS;
+        runs[r].length = remaining < SORT_RUN_RECORDS ? remaining : SORT_RUN_RECORDS;
+        runs[r].buf    = malloc(sizeof(struct employee_rec_t) * SORT_MERGE_RECORDS);
+        status         = runs[r].buf == NULL ? STATUS_ERROR : refill(sorter, &runs[r], r);
+        heap[n++]      = r;
+    }
+    for (int i = n / 2 - 1; status == STATUS_SUCCESS && i >= 0; i--) {
+        sift_down(sorter, runs, heap, n, i);
+    }
+
+    while (status == STATUS_SUCCESS && n > 0) {
+        struct merge_run_t* run = &runs[heap[0]];
+        status                  = emit(sorter, names, &run->buf[run->head++], format, printed);
+        if (status == STATUS_SUCCESS && run->head == run->filled) {
+            if (run->next < run->length) {
+                status = refill(sorter, run, heap[0]);
+            } else {
+                heap[0] = heap[--n];
+            }
+        }
+        sift_down(sorter, runs, heap, n, 0);
+    }
+
+    for (int r = 0; runs && r < sorter->nruns; r++) {
+        free(runs[r].buf);
+    }
+    free(runs);
+    free(heap);
+    if (status == STATUS_ERROR) {
+        report_error("Merging %d sorted runs failed\n", sorter->nruns);
+    }
+    return status;
+}
+
+// a table that fit in one run never touches the disk
+int sorter_list(struct sorter_t* sorter, int format) {
+    struct strpool_t* names = NULL;
+    if (strpool_create(&names) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    int status  = STATUS_SUCCESS;
+    int printed = 0;
+    list_begin(format);
+    if (sorter->nruns == 0) {
+        sort_run(sorter);
+        for (int i = 0; status == STATUS_SUCCESS && i < sorter->used; i++) {
+            status = emit(sorter, names, &sorter->run[sorter->order[i]], format, &printed);
+        }
+    } else {
+        if (sorter->used > 0) {
+            status = spill_run(sorter);
+        }
+        if (status == STATUS_SUCCESS) {
+            status = merge_runs(sorter, names, format, &printed);
+        }
+    }
+    list_end(format);
+    strpool_free(names);
+    return status;
+}
+
+void sorter_free(struct sorter_t* sorter) {
+    if (sorter == NULL) {
+        return;
+    }
+    if (sorter->spill) {
+        fclose(sorter->spill);
+    }
+    free(sorter->run);
+    free(sorter->order);
+    free(sorter->scratch);
+    free(sorter);
+}
+
+int topk_create(int field, int k, struct dict_t* addresses, struct topk_t** topkOut) {
+    struct topk_t* topk = calloc(1, sizeof(struct topk_t));
+    if (topk == NULL) {
+        report_error("Calloc failed\n");
+        return STATUS_ERROR;
+    }
+    topk->field     = field;
+    topk->k         = k;
+    topk->addresses = addresses;
+    topk->recs      = malloc(sizeof(struct employee_rec_t) * k);
+    topk->seqs      = malloc(sizeof(unsigned int) * k);
+    if (topk->recs == NULL || topk->seqs == NULL) {
+        report_error("Malloc failed\n");
+        topk_free(topk);
+        return STATUS_ERROR;
+    }
+    *topkOut = topk;
+    return STATUS_SUCCESS;
+}
+
+// whether slot a ranks below slot b: a smaller key, or the same key seen later
+static bool topk_below(struct topk_t* topk, int a, int b) {
+    struct sorter_t keys = { .field = topk->field, .addresses = topk->addresses };
+    int c                = compare_records(&keys, &topk->recs[a], &topk->recs[b]);
+    return c < 0 || (c == 0 && topk->seqs[a] > topk->seqs[b]);
+}
+
+static void topk_swap(struct topk_t* topk, int a, int b) {
+    struct employee_rec_t rec = topk->recs[a];
+    unsigned int seq          = topk->seqs[a];
+    topk->recs[a]             = topk->recs[b];
+    topk->seqs[a]             = topk->seqs[b];
+    topk->recs[b]             = rec;
+    topk->seqs[b]             = seq;
+}
+
+static void topk_sift_down(struct topk_t* topk, int n, int i) {
+    for (;;) {
+        int lowest = i;
+        int left   = 2 * i + 1;
+        int right  = left + 1;
+        if (left < n && topk_below(topk, left, lowest)) {
+            lowest = left;
+        }
+        if (right < n && topk_below(topk, right, lowest)) {
+            lowest = right;
+        }
+        if (lowest == i) {
+            return;
+        }
+        topk_swap(topk, i, lowest);
+        i = lowest;
+    }
+}
+
+// compare_records with the left side still decoded
+static int compare_employee(struct topk_t* topk, const struct employee_t* e, const struct employee_rec_t* rec) {
+    if (topk->field == SORT_BY_HOURS) {
+        unsigned int y = ntohl(rec->hours);
+        return (e->hours > y) - (e->hours < y);
+    }
+    if (topk->field == SORT_BY_ADDRESS) {
+        return strcmp(dict_string(topk->addresses, e->address_id), dict_string(topk->addresses, ntohl(rec->address_id)));
+    }
+    return strncmp(e->name, rec->name, sizeof(rec->name));
+}
+
+int topk_add(struct topk_t* topk, const struct employee_t* e) {
+    unsigned int seq = topk->seen++;
+    if (topk->n < topk->k) {
+        int i = topk->n++;
+        encode_employee(e, &topk->recs[i]);
+        topk->seqs[i] = seq;
+        for (int parent = (i - 1) / 2; i > 0 && topk_below(topk, i, parent); parent = (i - 1) / 2) {
+            topk_swap(topk, i, parent);
+            i = parent;
+        }
+        return STATUS_SUCCESS;
+    }
+    // most records lose to the root on the key alone and are never encoded
+    if (compare_employee(topk, e, &topk->recs[0]) <= 0) {
+        return STATUS_SUCCESS;
+    }
+    encode_employee(e, &topk->recs[0]);
+    topk->seqs[0] = seq;
+    topk_sift_down(topk, topk->n, 0);
+    return STATUS_SUCCESS;
+}
+
+// popping the root moves the lowest kept record to the end, so the heap
+// sorts itself in place into best-first order
+int topk_list(struct topk_t* topk, int format) {
+    struct strpool_t* names = NULL;
+    if (strpool_create(&names) == STATUS_ERROR) {
+        return STATUS_ERROR;
+    }
+    for (int n = topk->n; n > 1; n--) {
+        topk_swap(topk, 0, n - 1);
+        topk_sift_down(topk, n - 1, 0);
+    }
+    struct sorter_t keys = { .field = topk->field, .addresses = topk->addresses };
+    int status           = STATUS_SUCCESS;
+    int printed          = 0;
+    list_begin(format);
+    for (int i = 0; i < topk->n && status == STATUS_SUCCESS; i++) {
+        status = emit(&keys, names, &topk->recs[i], format, &printed);
+    }
+    list_end(format);
+    strpool_free(names);
+    return status;
+}
+
+void topk_free(struct topk_t* topk) {
+    if (topk == NULL) {
+        return;
+    }
+    free(topk->recs);
+    free(topk->seqs);
+    free(topk);
+}
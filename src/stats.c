@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+#include "stats.h"
+
+struct db_stats_t db_stats = { 0 };
+
+static const char* phase_names[PHASE_COUNT] = {
+    "open", "validate", "load", "mutate", "list", "write",
+};
+
+static const char* syscall_names[SYSCALL_COUNT] = {
+    "open", "read", "write", "sync", "lock", "ring_enter", "other",
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void stats_enable(void) {
+    db_stats.enabled = true;
+    db_stats.started = now_seconds();
+    atexit(stats_print_json);
+}
+
+void stats_phase_begin(enum db_phase_t phase) {
+    if (db_stats.enabled) {
+        db_stats.phase_started[phase] = now_seconds();
+    }
+}
+
+void stats_phase_end(enum db_phase_t phase) {
+    if (db_stats.enabled) {
+        db_stats.phase_seconds[phase] += now_seconds() - db_stats.phase_started[phase];
+    }
+}
+
+void stats_bytes(bool written, ssize_t bytes) {
+    if (bytes <= 0) {
+        return;
+    }
+    if (written) {
+        db_stats.bytes_written += bytes;
+    } else {
+        db_stats.bytes_read += bytes;
+    }
+}
+
+void stats_syscall(enum db_syscall_t kind, ssize_t bytes) {
+    db_stats.syscalls[kind]++;
+    if (kind == SYSCALL_READ || kind == SYSCALL_WRITE) {
+        stats_bytes(kind == SYSCALL_WRITE, bytes);
+    }
+}
+
+void stats_pool(unsigned long hits, unsigned long misses, unsigned long writebacks) {
+    db_stats.pool_hits += hits;
+    db_stats.pool_misses += misses;
+    db_stats.pool_writebacks += writebacks;
+}
+
+// stderr, so a listing on stdout stays clean for whoever consumes it
+void stats_print_json(void) {
+    struct rusage usage = { 0 };
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(stderr, "{\"wall_seconds\":%.6f,\"phases\":{", now_seconds() - db_stats.started);
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        fprintf(stderr, "%s\"%s\":%.6f", i ? "," : "", phase_names[i], db_stats.phase_seconds[i]);
+    }
+    fprintf(stderr, "},\"syscalls\":{");
+    for (int i = 0; i < SYSCALL_COUNT; i++) {
+        fprintf(stderr, "%s\"%s\":%lu", i ? "," : "", syscall_names[i], db_stats.syscalls[i]);
+    }
+    fprintf(stderr, "},\"pool\":{\"hits\":%lu,\"misses\":%lu,\"writebacks\":%lu}", db_stats.pool_hits,
+            db_stats.pool_misses, db_stats.pool_writebacks);
+    fprintf(stderr, ",\"bytes_read\":%llu,\"bytes_written\":%llu,\"peak_rss_kb\":%ld}\n", db_stats.bytes_read,
+            db_stats.bytes_written, usage.ru_maxrss);
+}
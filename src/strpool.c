@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "error.h"
+#include "strpool.h"
+
+#define STRPOOL_MIN_BLOCK 4096
+#define STRPOOL_MAX_BLOCK 65536
+#define STRPOOL_MIN_SLOTS 64
+
+unsigned int strpool_hash(const char* s, size_t len) {
+    // FNV-1a
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    }
+    return h;
+}
+
+static struct strpool_entry_t* find_slot(struct strpool_t* pool, const char* s, size_t len, unsigned int hash) {
+    unsigned int mask = pool->nslots - 1;
+    for (unsigned int i = hash & mask;; i = (i + 1) & mask) {
+        struct strpool_entry_t* slot = &pool->slots[i];
+        if (slot->s == NULL || (slot->hash == hash && slot->len == len && memcmp(slot->s, s, len) == 0)) {
+            return slot;
+        }
+    }
+}
+
+static int grow_slots(struct strpool_t* pool) {
+    unsigned int nslots           = pool->nslots ? pool->nslots * 2 : STRPOOL_MIN_SLOTS;
+    struct strpool_entry_t* old   = pool->slots;
+    unsigned int old_nslots       = pool->nslots;
+    struct strpool_entry_t* slots = calloc(nslots, sizeof(struct strpool_entry_t));
+    if (slots == NULL) {
+        report_error("Calloc failed\n");
+        return STATUS_ERROR;
+    }
+    pool->slots  = slots;
+    pool->nslots = nslots;
+    for (unsigned int i = 0; i < old_nslots; i++) {
+        if (old[i].s != NULL) {
+            *find_slot(pool, old[i].s, old[i].len, old[i].hash) = old[i];
+        }
+    }
+    free(old);
+    return STATUS_SUCCESS;
+}
+
+int strpool_create(struct strpool_t** poolOut) {
+    struct strpool_t* pool = calloc(1, sizeof(struct strpool_t));
+    if (pool == NULL || grow_slots(pool) == STATUS_ERROR) {
+        report_error("Calloc failed\n");
+        free(pool);
+        return STATUS_ERROR;
+    }
+    *poolOut = pool;
+    return STATUS_SUCCESS;
+}
+
+// blocks double up to STRPOOL_MAX_BLOCK, so a pool for one page stays small
+static char* pool_alloc(struct strpool_t* pool, size_t len) {
+    struct strpool_block_t* block = pool->blocks;
+    if (block == NULL || block->size - block->used < len) {
+        size_t size = block ? block->size * 2 : STRPOOL_MIN_BLOCK;
+        size        = size > STRPOOL_MAX_BLOCK ? STRPOOL_MAX_BLOCK : size;
+        size        = size < len ? len : size;
+        block       = malloc(sizeof(struct strpool_block_t) + size);
+        if (block == NULL) {
+            report_error("Malloc failed\n");
+            return NULL;
+        }
+        block->next  = pool->blocks;
+        block->size  = size;
+        block->used  = 0;
+        pool->blocks = block;
+    }
+    char* p = block->bytes + block->used;
+    block->used += len;
+    return p;
+}
+
+// returns the pooled copy of s, NULL when out of memory
+const char* strpool_intern(struct strpool_t* pool, const char* s, size_t len, unsigned int hash) {
+    struct strpool_entry_t* slot = find_slot(pool, s, len, hash);
+    if (slot->s != NULL) {
+        return slot->s;
+    }
+    if ((pool->count + 1) * 2 > pool->nslots) {
+        if (grow_slots(pool) == STATUS_ERROR) {
+            return NULL;
+        }
+        slot = find_slot(pool, s, len, hash);
+    }
+    char* copy = pool_alloc(pool, len + 1);
+    if (copy == NULL) {
+        return NULL;
+    }
+    memcpy(copy, s, len);
+    copy[len]  = '\0';
+    slot->s    = copy;
+    slot->hash = hash;
+    slot->len  = len;
+    pool->count++;
+    return copy;
+}
+
+void strpool_reset(struct strpool_t* pool) {
+    while (pool->blocks != NULL) {
+        struct strpool_block_t* next = pool->blocks->next;
+        free(pool->blocks);
+        pool->blocks = next;
+    }
+    memset(pool->slots, 0, sizeof(struct strpool_entry_t) * pool->nslots);
+    pool->count = 0;
+}
+
+void strpool_free(struct strpool_t* pool) {
+    if (pool == NULL) {
+        return;
+    }
+    strpool_reset(pool);
+    free(pool->slots);
+    free(pool);
+}
@@ -0,0 +1,128 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "common.h"
+#include "cursor.h"
+#include "file.h"
+#include "parse.h"
+
+// libFuzzer entry point: the input is a whole database file, put behind an fd
+// and run through every read path a CLI run can take on it. Built without
+// libFuzzer (-DFUZZ_STANDALONE) it replays the files it is given, which is
+// also the binary AFL drives.
+
+static void load_table(int fd, struct db_header_t* header, struct dict_t* addresses) {
+    struct strpool_t* names      = NULL;
+    struct employee_t* employees = NULL;
+    if (strpool_create(&names) == STATUS_SUCCESS && read_employees(fd, header, names, addresses, &employees) == STATUS_SUCCESS) {
+        for (int i = 0; i < header->count; i++) {
+            list_employee(&employees[i], addresses, LIST_FORMAT_TSV, i);
+        }
+        free(employees);
+    }
+    strpool_free(names);
+}
+
+static void stream_table(int fd, struct db_header_t* header, struct dict_t* addresses) {
+    struct db_cursor_t* cursor = NULL;
+    if (db_cursor_open(fd, header, &cursor) == STATUS_ERROR) {
+        return;
+    }
+    const struct employee_t* e = NULL;
+    for (int i = 0; db_cursor_next(cursor, &e) == STATUS_SUCCESS && e != NULL; i++) {
+        list_employee(e, addresses, LIST_FORMAT_JSON, i);
+    }
+    db_cursor_close(cursor);
+}
+
+static void parse_file(int fd) {
+    struct db_header_t* header = NULL;
+    if (retrieve_and_validate_db_header(fd, &header) == STATUS_ERROR) {
+        return;
+    }
+    print_db_info(header, LIST_FORMAT_TEXT);
+
+    struct dict_t* addresses = NULL;
+    if (read_address_dict(fd, header, &addresses) == STATUS_SUCCESS) {
+        struct bloom_t* bloom = NULL;
+        if (read_name_bloom(fd, header, &bloom) == STATUS_SUCCESS) {
+            bloom_free(bloom);
+        }
+        load_table(fd, header, addresses);
+        stream_table(fd, header, addresses);
+        dict_free(addresses);
+    }
+    if (!(header->flags & DB_FLAG_V1)) {
+        struct verify_result_t result;
+        verify_db_file(fd, header, &result);
+    }
+    free(header);
+}
+
+// the same bytes as an -a string, which is parsed before any file is touched
+static void parse_addstring(const uint8_t* data, size_t size) {
+    char* addstring = malloc(size + 1);
+    struct strpool_t* names  = NULL;
+    struct dict_t* addresses = NULL;
+    if (addstring != NULL && strpool_create(&names) == STATUS_SUCCESS && dict_create(&addresses) == STATUS_SUCCESS) {
+        memcpy(addstring, data, size);
+        addstring[size] = '\0';
+        struct employee_t e;
+        parse_employee(addstring, names, addresses, &e);
+    }
+    free(addstring);
+    strpool_free(names);
+    dict_free(addresses);
+}
+
+int LLVMFuzzerInitialize(int* argc, char*** argv) {
+    (void)argc;
+    (void)argv;
+    // the parsers report every problem on stdout, that is only noise here
+    if (freopen("/dev/null", "w", stdout) == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    int fd = memfd_create("fuzz_parse", 0);
+    if (fd == -1) {
+        return 0;
+    }
+    if (size == 0 || write_full(fd, data, size) == STATUS_SUCCESS) {
+        parse_file(fd);
+    }
+    close(fd);
+    parse_addstring(data, size);
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+int main(int argc, char* argv[]) {
+    LLVMFuzzerInitialize(&argc, &argv);
+    for (int i = 1; i < argc; i++) {
+        FILE* in = fopen(argv[i], "rb");
+        if (in == NULL) {
+            perror(argv[i]);
+            return 1;
+        }
+        fseek(in, 0, SEEK_END);
+        long size = ftell(in);
+        fseek(in, 0, SEEK_SET);
+        uint8_t* data = malloc(size > 0 ? size : 1);
+        if (data == NULL || fread(data, 1, size, in) != (size_t)size) {
+            perror(argv[i]);
+            return 1;
+        }
+        fclose(in);
+        LLVMFuzzerTestOneInput(data, size);
+        free(data);
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,186 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "dbview.h"
+
+// model-based test of the library: random adds, updates, deletes, lookups,
+// syncs and reopens run against a database and against a plain array that
+// says what the database must hold; every few hundred operations the whole
+// table is listed and compared. Prints the operations per second it ran at.
+//
+//   model_test [path] [operations] [seed]
+
+#define MODEL_NAMES 1000
+#define MODEL_ADDRESSES 37
+#define MODEL_CHECK_EVERY 500
+#define MODEL_SYNC_EVERY 64
+#define MODEL_REOPEN_EVERY 2000
+
+struct model_entry_t {
+    bool live;
+    int address;
+    unsigned int hours;
+};
+
+struct model_t {
+    struct model_entry_t entries[MODEL_NAMES];
+    int live;
+    int seen;
+    bool mismatch;
+};
+
+static unsigned int rng_state;
+
+static unsigned int next_random(void) {
+    // xorshift32, so a seed replays the same run on every libc
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static void name_of(int id, char* out, size_t size) {
+    snprintf(out, size, "Employee %d", id);
+}
+
+static void address_of(int address, char* out, size_t size) {
+    snprintf(out, size, "%d Model Street", address);
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int check_record(struct model_t* model, const struct dbview_record_t* record) {
+    int id = -1;
+    if (sscanf(record->name, "Employee %d", &id) != 1 || id < 0 || id >= MODEL_NAMES) {
+        fprintf(stderr, "unexpected record %s\n", record->name);
+        return 1;
+    }
+    struct model_entry_t* entry = &model->entries[id];
+    char address[64];
+    address_of(entry->address, address, sizeof(address));
+    if (!entry->live || entry->hours != record->hours || strcmp(address, record->address) != 0) {
+        fprintf(stderr, "record %s: %s, %u hours, the model has %s, %s, %u hours\n", record->name, record->address,
+                record->hours, entry->live ? "live" : "deleted", address, entry->hours);
+        return 1;
+    }
+    return 0;
+}
+
+static int visit(const struct dbview_record_t* record, void* ctx) {
+    struct model_t* model = ctx;
+    model->seen++;
+    if (check_record(model, record) != 0) {
+        model->mismatch = true;
+        return 1;
+    }
+    return 0;
+}
+
+static bool check_table(struct dbview_t* db, struct model_t* model) {
+    model->seen     = 0;
+    model->mismatch = false;
+    dbview_iterate(db, visit, model);
+    if (!model->mismatch && (model->seen != model->live || dbview_count(db) != model->live)) {
+        fprintf(stderr, "listed %d records, counted %d, the model has %d\n", model->seen, dbview_count(db), model->live);
+        model->mismatch = true;
+    }
+    return !model->mismatch;
+}
+
+// one random operation; false when the database disagrees with the model
+static bool step(struct dbview_t* db, struct model_t* model) {
+    int id                      = next_random() % MODEL_NAMES;
+    struct model_entry_t* entry = &model->entries[id];
+    char name[32];
+    char address[64];
+    name_of(id, name, sizeof(name));
+    unsigned int op = next_random() % 10;
+
+    if (op < 4) {
+        // names stay unique, an add of a live one becomes an update
+        int addr           = next_random() % MODEL_ADDRESSES;
+        unsigned int hours = next_random() % 80;
+        address_of(addr, address, sizeof(address));
+        int status = entry->live ? dbview_update(db, name, address, hours) : dbview_add(db, name, address, hours);
+        if (status != 0) {
+            fprintf(stderr, "%s of %s failed: %s\n", entry->live ? "update" : "add", name, dbview_errmsg());
+            return false;
+        }
+        model->live += entry->live ? 0 : 1;
+        entry->live    = true;
+        entry->address = addr;
+        entry->hours   = hours;
+        return true;
+    }
+    if (op < 7) {
+        int status = dbview_delete(db, name);
+        if ((status == 0) != entry->live) {
+            fprintf(stderr, "delete of %s returned %d, the model has it %s\n", name, status, entry->live ? "live" : "absent");
+            return false;
+        }
+        model->live -= entry->live ? 1 : 0;
+        entry->live = false;
+        return true;
+    }
+
+    struct dbview_record_t record;
+    int status = dbview_get(db, name, &record);
+    if ((status == 0) != entry->live) {
+        fprintf(stderr, "get of %s returned %d, the model has it %s\n", name, status, entry->live ? "live" : "absent");
+        return false;
+    }
+    return status != 0 || check_record(model, &record) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    const char* path  = argc > 1 ? argv[1] : "obj/model.db";
+    long ops          = argc > 2 ? atol(argv[2]) : 20000;
+    rng_state         = argc > 3 ? strtoul(argv[3], NULL, 10) : (unsigned int)time(NULL);
+    rng_state         = rng_state ? rng_state : 1;
+    unsigned int seed = rng_state;
+
+    struct model_t* model = calloc(1, sizeof(struct model_t));
+    struct dbview_t* db   = NULL;
+    if (model == NULL || dbview_open(path, DBVIEW_CREATE, &db) != 0) {
+        fprintf(stderr, "cannot create %s: %s\n", path, dbview_errmsg());
+        return 1;
+    }
+
+    double started = now_seconds();
+    bool ok        = true;
+    long op        = 0;
+    for (; op < ops && ok; op++) {
+        ok = step(db, model);
+        if (ok && op % MODEL_SYNC_EVERY == MODEL_SYNC_EVERY - 1) {
+            ok = dbview_sync(db) == 0;
+        }
+        // what was synced has to come back from the file alone
+        if (ok && op % MODEL_REOPEN_EVERY == MODEL_REOPEN_EVERY - 1) {
+            ok = dbview_close(db) == 0;
+            db = NULL;
+            ok = ok && dbview_open(path, 0, &db) == 0;
+        }
+        if (ok && op % MODEL_CHECK_EVERY == MODEL_CHECK_EVERY - 1) {
+            ok = check_table(db, model);
+        }
+    }
+    ok = dbview_close(db) == 0 && ok;
+    db = NULL;
+    ok = ok && dbview_open(path, DBVIEW_READONLY, &db) == 0 && check_table(db, model);
+    double elapsed = now_seconds() - started;
+    dbview_close(db);
+    free(model);
+
+    if (!ok) {
+        fprintf(stderr, "model test failed at operation %ld, seed %u\n", op, seed);
+        return 1;
+    }
+    fprintf(stderr, "model test: %ld operations in %.2f s, %.0f ops/sec, seed %u\n", ops, elapsed, ops / elapsed, seed);
+    return 0;
+}